@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "present.hh"
+#include "render.hh"
+#include "scenes.hh"
+
+/*
+ * Renders the canned scenes headlessly, as fast as possible, and reports how
+ * long frames took. Nothing goes to the terminal except the results; the
+ * presenter (if used) writes to /dev/null, so the encoding and the syscall
+ * are measured but not the terminal.
+ *
+ * Usage: bench [-s scenes] [-g WxH,...] [-j workers,...] [-r formats]
+ *              [-p modes] [-n frames] [-w warmup] [-o text|json]
+ * Lists are comma-separated. Raster formats are double, float and fixed (see
+ * raster.hh). Presenter modes are none (render only), diff (only send
+ * changes, as main does) and full (send every cell every frame).
+ */
+
+enum Present_mode {present_none, present_diff, present_full};
+static const char *present_names[] = {"none", "diff", "full"};
+
+struct Bench_result {
+	const Scene *scene;
+	int width, height, workers;
+	Raster_format format;
+	enum Present_mode mode;
+	int frames;
+	size_t triangles;
+	/* Nanoseconds per frame */
+	double mean, p50, p90, p99, max;
+	double bytes_per_frame;
+};
+
+static double now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+static Bench_result run(const Scene *scene, int width, int height, int workers,
+		Raster_format format, enum Present_mode mode, int frames, int warmup,
+		int null_fd)
+{
+	Bench_result res;
+	res.scene = scene;
+	res.width = width;
+	res.height = height;
+	res.workers = workers;
+	res.format = format;
+	res.mode = mode;
+	res.frames = frames;
+
+	Renderer renderer(height, width, 3.0, scene->max_objects, workers, format);
+	res.triangles = scene->build(&renderer);
+	Presenter presenter(null_fd, height, width);
+
+	std::vector<double> times;
+	times.reserve(frames);
+	double bytes = 0.0;
+	for (int f = 0; f < warmup + frames; ++f) {
+		double t0 = now_ns();
+		scene_camera(scene, f, &renderer);
+		Screen_span frame = renderer.render();
+		ssize_t n = 0;
+		if (mode == present_full)
+			presenter.invalidate();
+		if (mode != present_none)
+			n = presenter.present(frame);
+		double t1 = now_ns();
+		if (f >= warmup) {
+			times.push_back(t1 - t0);
+			bytes += n;
+		}
+	}
+
+	double total = 0.0;
+	for (size_t i = 0; i < times.size(); ++i)
+		total += times[i];
+	std::sort(times.begin(), times.end());
+	res.mean = total / frames;
+	res.p50 = percentile(times, 0.5);
+	res.p90 = percentile(times, 0.9);
+	res.p99 = percentile(times, 0.99);
+	res.max = times.back();
+	res.bytes_per_frame = bytes / frames;
+	return res;
+}
+
+static void print_text(const Bench_result &r, int header)
+{
+	if (header) {
+		printf("%-12s %9s %3s %-6s %-4s %10s %10s %10s %10s %10s %10s %8s\n",
+				"scene", "size", "thr", "raster", "pres", "mean(us)", "p50(us)",
+				"p90(us)", "p99(us)", "Mtri/s", "Mcell/s", "B/frame");
+	}
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d", r.width, r.height);
+	printf("%-12s %9s %3d %-6s %-4s %10.1f %10.1f %10.1f %10.1f %10.2f %10.2f "
+			"%8.0f\n", r.scene->name, size, r.workers,
+			raster_format_name(r.format), present_names[r.mode],
+			r.mean / 1e3, r.p50 / 1e3, r.p90 / 1e3, r.p99 / 1e3,
+			r.triangles / r.mean * 1e3, (double) r.width * r.height / r.mean
+			* 1e3, r.bytes_per_frame);
+}
+
+static void print_json(const Bench_result &r, int first)
+{
+	printf("%s\n  {\"scene\": \"%s\", \"width\": %d, \"height\": %d, "
+			"\"workers\": %d, \"raster\": \"%s\", \"present\": \"%s\", "
+			"\"frames\": %d, "
+			"\"triangles\": %zu, \"ns_mean\": %.0f, \"ns_p50\": %.0f, "
+			"\"ns_p90\": %.0f, \"ns_p99\": %.0f, \"ns_max\": %.0f, "
+			"\"triangles_per_s\": %.0f, \"cells_per_s\": %.0f, "
+			"\"bytes_per_frame\": %.1f}",
+			first ? "[" : ",", r.scene->name, r.width, r.height, r.workers,
+			raster_format_name(r.format), present_names[r.mode], r.frames,
+			r.triangles, r.mean, r.p50, r.p90, r.p99, r.max, r.triangles / r.mean * 1e9,
+			(double) r.width * r.height / r.mean * 1e9, r.bytes_per_frame);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s scenes] [-g WxH,...] [-j workers,...] "
+			"[-r double|float|fixed,...] [-p none|diff|full,...] [-n frames] [-w warmup] "
+			"[-o text|json]\nscenes:\n", prog);
+	print_scenes(stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const Scene *> which;
+	std::vector<std::pair<int, int> > sizes;
+	std::vector<int> workers;
+	std::vector<Raster_format> formats;
+	std::vector<enum Present_mode> modes;
+	int frames = 300;
+	int warmup = 20;
+	int json = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:g:j:r:p:n:w:o:h")) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_scenes(optarg, &which) < 0)
+				usage(argv[0]);
+			break;
+		case 'g':
+			if (parse_sizes(optarg, &sizes) < 0)
+				usage(argv[0]);
+			break;
+		case 'j':
+			if (parse_workers(optarg, &workers) < 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (parse_formats(optarg, &formats) < 0)
+				usage(argv[0]);
+			break;
+		case 'p': {
+			std::vector<std::string> list = split_list(optarg);
+			for (size_t i = 0; i < list.size(); ++i) {
+				int m;
+				for (m = 0; m < 3; ++m) {
+					if (list[i] == present_names[m])
+						break;
+				}
+				if (m == 3)
+					usage(argv[0]);
+				modes.push_back((enum Present_mode) m);
+			}
+			break;
+		}
+		case 'n':
+			frames = atoi(optarg);
+			if (frames < 1)
+				usage(argv[0]);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			if (warmup < 0)
+				usage(argv[0]);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "json"))
+				json = 1;
+			else if (strcmp(optarg, "text"))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Defaults: everything, at main's size and two bigger ones */
+	if (which.empty()) {
+		for (int i = 0; i < n_scenes; ++i)
+			which.push_back(&scenes[i]);
+	}
+	if (sizes.empty()) {
+		sizes.push_back(std::make_pair(56, 24));
+		sizes.push_back(std::make_pair(160, 60));
+		sizes.push_back(std::make_pair(320, 100));
+	}
+	if (workers.empty()) {
+		workers.push_back(1);
+		int n = (int) std::thread::hardware_concurrency();
+		if (n > 1)
+			workers.push_back(n);
+	}
+	if (formats.empty())
+		formats.push_back(raster_double);
+	if (modes.empty())
+		modes.push_back(present_diff);
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd < 0) {
+		perror("/dev/null");
+		return 1;
+	}
+
+	int first = 1;
+	for (size_t s = 0; s < which.size(); ++s) {
+		for (size_t g = 0; g < sizes.size(); ++g) {
+			for (size_t j = 0; j < workers.size(); ++j) {
+				for (size_t f = 0; f < formats.size(); ++f) {
+					for (size_t m = 0; m < modes.size(); ++m) {
+						Bench_result r = run(which[s], sizes[g].first,
+								sizes[g].second, workers[j], formats[f],
+								modes[m], frames, warmup, null_fd);
+						if (json)
+							print_json(r, first);
+						else
+							print_text(r, first);
+						fflush(stdout);
+						first = 0;
+					}
+				}
+			}
+		}
+	}
+	if (json)
+		printf("%s]\n", first ? "[" : "\n");
+
+	close(null_fd);
+	return 0;
+}
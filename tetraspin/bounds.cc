@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+#include "bounds.hh"
+
+Aabb::Aabb()
+{
+	double inf = std::numeric_limits<double>::infinity();
+	lo = Vec3(inf, inf, inf);
+	hi = Vec3(-inf, -inf, -inf);
+}
+
+void Aabb::grow(Vec3 p)
+{
+	lo = Vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+	hi = Vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+}
+
+void Aabb::grow(const Aabb &b)
+{
+	grow(b.lo);
+	grow(b.hi);
+}
+
+void Frustum::set(const Camera_basis &c, int screen_x, int screen_y,
+		double scr_x_c, double scr_y_c)
+{
+	/*
+	 * A point at A = P - C0 lands on the plane at (A.Cr, A.Cu) * d/(A.Cf).
+	 * So |A.Cr| * d <= half_width * A.Cf (and likewise vertically) for
+	 * anything on screen, which makes the side planes. The extra cell
+	 * covers rounding and the cell-centre sampling.
+	 */
+	double hw = (screen_x / 2.0 + 1.0) / scr_x_c;
+	double hh = (screen_y / 2.0 + 1.0) / scr_y_c;
+	double d = c.depth;
+
+	n[0] = c.forward;
+	n[1] = vec_sub(vec_mult(c.forward, hw), vec_mult(c.right, d));
+	n[2] = vec_add(vec_mult(c.forward, hw), vec_mult(c.right, d));
+	n[3] = vec_sub(vec_mult(c.forward, hh), vec_mult(c.up, d));
+	n[4] = vec_add(vec_mult(c.forward, hh), vec_mult(c.up, d));
+	for (int i = 0; i < n_planes; ++i)
+		w[i] = -vec_dot(n[i], c.origin);
+}
+
+Aabb Aabb::transformed(const Transform &t) const
+{
+	if (this->empty())
+		return *this;
+	/* Half the box's size along each world axis is what its extent adds */
+	Vec3 c = t.apply(this->centre());
+	Vec3 e = this->extent();
+	Vec3 half;
+	for (int i = 0; i < 3; ++i)
+		half[i] = t.scale * (fabs(t.rot[i].x) * e.x + fabs(t.rot[i].y) * e.y +
+				fabs(t.rot[i].z) * e.z);
+	Aabb b;
+	b.lo = vec_sub(c, half);
+	b.hi = vec_add(c, half);
+	return b;
+}
+
+Frustum Frustum::to_model(const Transform &t) const
+{
+	/*
+	 * A world point P = translation + scale * (rotation p), so
+	 * n.P + w = (scale * rotation^T n).p + (n.translation + w)
+	 */
+	Frustum f;
+	for (int i = 0; i < n_planes; ++i) {
+		f.n[i] = vec_mult(t.to_model_dir(this->n[i]), t.scale);
+		f.w[i] = vec_dot(this->n[i], t.translation) + this->w[i];
+	}
+	return f;
+}
+
+Frustum::Result Frustum::test(const Aabb &b) const
+{
+	if (b.empty())
+		return outside;
+
+	Vec3 c = b.centre();
+	Vec3 e = b.extent();
+	Result r = inside;
+	for (int i = 0; i < n_planes; ++i) {
+		double dist = vec_dot(n[i], c) + w[i];
+		double reach = fabs(n[i].x) * e.x + fabs(n[i].y) * e.y +
+			fabs(n[i].z) * e.z;
+		/*
+		 * Allow for rounding in the sums above, which can be large
+		 * compared to the result far from the origin
+		 */
+		double slack = 1e-9 * (fabs(vec_dot(n[i], c)) + fabs(w[i]) + reach);
+		if (dist + reach < -slack)
+			return outside;
+		if (dist - reach < slack)
+			r = intersecting;
+	}
+	return r;
+}
+
+void Bvh::build(const Vertex_buffer &v, const Cow_vector<unsigned> &indices)
+{
+	size_t n = indices.size() / 3;
+	std::vector<Aabb> tri_boxes(n);
+	std::vector<Vec3> centres(n);
+	/* Not resize() straight away, which would copy a borrowed order */
+	order.clear();
+	order.resize(n);
+	for (size_t t = 0; t < n; ++t) {
+		for (int i = 0; i < 3; ++i)
+			tri_boxes[t].grow(v[indices[3 * t + i]]);
+		centres[t] = tri_boxes[t].centre();
+		order[t] = (unsigned) t;
+	}
+
+	nodes.clear();
+	/* A binary tree with leaves of at least half leaf_size */
+	nodes.reserve(2 * (n / (leaf_size / 2) + 1));
+	nodes.push_back(Node());
+	build_node(0, 0, (unsigned) n, tri_boxes, centres);
+}
+
+void Bvh::build_node(unsigned me, unsigned first, unsigned count,
+		const std::vector<Aabb> &tri_boxes, const std::vector<Vec3> &centres)
+{
+	Aabb box;
+	Aabb spread;
+	for (unsigned i = first; i < first + count; ++i) {
+		box.grow(tri_boxes[order[i]]);
+		spread.grow(centres[order[i]]);
+	}
+	nodes[me].box = box;
+	nodes[me].first = first;
+	nodes[me].count = count;
+	nodes[me].left = 0;
+	if (count <= leaf_size)
+		return;
+
+	/* Split at the median along the axis the centres spread furthest */
+	Vec3 size = vec_sub(spread.hi, spread.lo);
+	int axis = 0;
+	if (size.y > size[axis])
+		axis = 1;
+	if (size.z > size[axis])
+		axis = 2;
+	unsigned half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half,
+			order.begin() + first + count,
+			[&](unsigned a, unsigned b) {
+				return centres[a][axis] < centres[b][axis];
+			});
+
+	/* Children go next to each other so only one index is needed */
+	unsigned left = (unsigned) nodes.size();
+	nodes.push_back(Node());
+	nodes.push_back(Node());
+	nodes[me].left = left;
+	build_node(left, first, half, tri_boxes, centres);
+	build_node(left + 1, first + half, count - half, tri_boxes, centres);
+}
+
+void Bvh::mark_all(const Node &node, uint64_t *mask) const
+{
+	for (unsigned i = node.first; i < node.first + node.count; ++i)
+		mask[order[i] >> 6] |= (uint64_t) 1 << (order[i] & 63);
+}
+
+size_t Bvh::mark_visible(const Frustum &f, uint64_t *mask) const
+{
+	size_t skipped = 0;
+	/* Small explicit stack; depth is logarithmic in the triangle count */
+	unsigned stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top) {
+		const Node &node = nodes[stack[--top]];
+		Frustum::Result r = f.test(node.box);
+		if (r == Frustum::outside) {
+			skipped += node.count;
+		} else if (r == Frustum::inside || !node.left) {
+			mark_all(node, mask);
+		} else {
+			stack[top++] = node.left + 1;
+			stack[top++] = node.left;
+		}
+	}
+	return skipped;
+}
@@ -0,0 +1,108 @@
+#ifndef BOUNDS_H_I
+#define BOUNDS_H_I
+
+#include <cstdint>
+#include <vector>
+
+#include "project.hh"
+#include "vec_ops.hh"
+
+/* Axis-aligned bounding box. An empty box has lo > hi. */
+struct Aabb {
+	Vec3 lo, hi;
+
+	Aabb();
+	void grow(Vec3 p);
+	void grow(const Aabb &b);
+	int empty() const { return lo.x > hi.x; }
+	Vec3 centre() const { return vec_mult(vec_add(lo, hi), 0.5); }
+	Vec3 extent() const { return vec_mult(vec_sub(hi, lo), 0.5); }
+	/* The box around this one once t has been applied to it */
+	Aabb transformed(const Transform &t) const;
+};
+
+/*
+ * The part of the world that can end up on the screen: in front of the
+ * camera and inside the four planes through the back of the camera and the
+ * edges of the screen (pushed out by a cell, so that rounding never culls
+ * something that would have drawn a cell).
+ * A point P is inside a plane if n.P + w >= 0.
+ */
+class Frustum {
+	public:
+		/*
+		 * Screen is screen_x by screen_y cells; scr_x_c and scr_y_c are
+		 * cells per camera plane unit across and down
+		 */
+		void set(const Camera_basis &c, int screen_x, int screen_y,
+				double scr_x_c, double scr_y_c);
+
+		enum Result { outside, intersecting, inside };
+		Result test(const Aabb &b) const;
+		/*
+		 * The same frustum in the coordinates of a model that t puts in
+		 * the world, so that the model's own bounds can be tested against
+		 * it without moving them
+		 */
+		Frustum to_model(const Transform &t) const;
+
+	private:
+		static const int n_planes = 5;
+		Vec3 n[n_planes];
+		double w[n_planes];
+};
+
+/*
+ * Bounding volume hierarchy over an indexed mesh's triangles, so that the
+ * parts of an object that are off-screen can be skipped a subtree at a time.
+ * Each node's triangles are a contiguous range of order[], which holds
+ * triangle numbers.
+ */
+class Bvh {
+	public:
+		void build(const Vertex_buffer &v, const Cow_vector<unsigned> &indices);
+		/*
+		 * Sets bit t of mask (64 triangles to a word) for every triangle t
+		 * in a node that isn't entirely outside f. Returns the number of
+		 * triangles skipped.
+		 */
+		size_t mark_visible(const Frustum &f, uint64_t *mask) const;
+		/* Whole mesh */
+		const Aabb &bounds() const { return nodes[0].box; }
+		int built() const { return !nodes.empty(); }
+
+		struct Node {
+			Aabb box;
+			/* Range of order[] this node covers */
+			unsigned first, count;
+			/* Children are nodes[left] and nodes[left + 1]; 0 in a leaf */
+			unsigned left;
+		};
+		/*
+		 * The tree as it is in memory, for saving, and for using a saved
+		 * one in place of building it (the memory has to stay there)
+		 */
+		const Cow_vector<Node> &node_array() const { return nodes; }
+		const Cow_vector<unsigned> &order_array() const { return order; }
+		void borrow(const Node *n, size_t n_nodes, const unsigned *o,
+				size_t n_order)
+		{
+			nodes.borrow(n, n_nodes);
+			order.borrow(o, n_order);
+		}
+
+	private:
+		/* Leaves hold at most this many triangles */
+		static const unsigned leaf_size = 8;
+
+		/* Fills in nodes[me] for order[first .. first + count) */
+		void build_node(unsigned me, unsigned first, unsigned count,
+				const std::vector<Aabb> &tri_boxes,
+				const std::vector<Vec3> &centres);
+		void mark_all(const Node &node, uint64_t *mask) const;
+
+		Cow_vector<Node> nodes;
+		Cow_vector<unsigned> order;
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "broadcast.hh"
+
+static long now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000l + t.tv_nsec;
+}
+
+/* Fills in addr for path; -1 (errno set) if path is too long for one */
+static int socket_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+Broadcast_server::Broadcast_server(int height, int width)
+	: width(width), height(height),
+	delta(Presenter::encode_only, height, width),
+	key(Presenter::encode_only, height, width), current((size_t) width * height), have_frame(0),
+	key_frame(0), key_len(0), listen_fd(-1)
+{
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	memset(&this->counts, 0, sizeof(this->counts));
+}
+
+Broadcast_server::~Broadcast_server()
+{
+	for (size_t i = 0; i < this->clients.size(); ++i)
+		close(this->clients[i].fd);
+	if (this->listen_fd >= 0) {
+		close(this->listen_fd);
+		unlink(this->path.c_str());
+	}
+	close(this->epoll_fd);
+}
+
+int Broadcast_server::listen(const char *path)
+{
+	struct sockaddr_un addr;
+	if (socket_address(path, &addr) < 0)
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	/* A socket left behind by a server that didn't get to tidy up */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			::listen(fd, 64) < 0) {
+		int e = errno;
+		close(fd);
+		errno = e;
+		return -1;
+	}
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	this->listen_fd = fd;
+	this->path = path;
+	return 0;
+}
+
+void Broadcast_server::accept_clients()
+{
+	while (1) {
+		int fd = accept4(this->listen_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		Client c;
+		c.fd = fd;
+		c.pending_sent = 0;
+		c.need_keyframe = 1;
+		c.caught_up_ns = now_ns();
+		c.want_out = 0;
+		/* Clients never say anything, so readable means gone */
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+		if ((size_t) fd >= this->client_of_fd.size())
+			this->client_of_fd.resize(fd + 1, -1);
+		this->client_of_fd[fd] = (int) this->clients.size();
+		this->clients.push_back(c);
+		++this->counts.joined;
+		/* Starts straight away, with whatever is on screen now */
+		if (this->catch_up(&this->clients.back()) < 0) {
+			this->remove(this->clients.size() - 1);
+			++this->counts.left;
+		}
+	}
+}
+
+void Broadcast_server::watch_out(Client *c, int on)
+{
+	if (c->want_out == on)
+		return;
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.fd = c->fd;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = on;
+}
+
+void Broadcast_server::remove(size_t i)
+{
+	close(this->clients[i].fd);
+	this->client_of_fd[this->clients[i].fd] = -1;
+	if (i + 1 < this->clients.size()) {
+		this->clients[i] = std::move(this->clients.back());
+		this->client_of_fd[this->clients[i].fd] = (int) i;
+	}
+	this->clients.pop_back();
+}
+
+int Broadcast_server::send_to(Client *c, const char *data, size_t len)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = send(c->fd, data + done, len - done,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		done += n;
+		this->counts.bytes_sent += n;
+	}
+	/* Only those that fall behind get a copy of their own */
+	c->pending.assign(data + done, data + len);
+	c->pending_sent = 0;
+	if (done == len)
+		c->caught_up_ns = now_ns();
+	this->watch_out(c, done < len);
+	return 0;
+}
+
+void Broadcast_server::keyframe(const char **data, size_t *len)
+{
+	if (this->key_frame != this->counts.frames) {
+		Screen_span s = {this->current.data(), this->width, this->height};
+		this->key.invalidate();
+		this->key_len = this->key.encode(s);
+		this->key_frame = this->counts.frames;
+		++this->counts.keyframes;
+		this->counts.bytes_encoded += this->key_len;
+	}
+	*data = this->key.buffer();
+	*len = this->key_len;
+}
+
+int Broadcast_server::catch_up(Client *c)
+{
+	if (c->pending_sent < c->pending.size()) {
+		/* The rest of a frame has to go, or the terminal gets half a sequence */
+		while (c->pending_sent < c->pending.size()) {
+			ssize_t n = send(c->fd, c->pending.data() + c->pending_sent,
+					c->pending.size() - c->pending_sent,
+					MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					this->watch_out(c, 1);
+					return 0;
+				}
+				return -1;
+			}
+			c->pending_sent += n;
+			this->counts.bytes_sent += n;
+		}
+		c->pending.clear();
+		c->pending_sent = 0;
+		c->caught_up_ns = now_ns();
+	}
+	if (!c->need_keyframe || !this->have_frame) {
+		this->watch_out(c, 0);
+		return 0;
+	}
+	const char *data;
+	size_t len;
+	this->keyframe(&data, &len);
+	c->need_keyframe = 0;
+	return this->send_to(c, data, len);
+}
+
+void Broadcast_server::broadcast(Screen_span frame)
+{
+	for (int y = 0; y < this->height; ++y)
+		memcpy(&this->current[(size_t) y * this->width], frame[y],
+				this->width * sizeof(Render_symbol));
+	this->have_frame = 1;
+	++this->counts.frames;
+	/* Once, for everybody */
+	size_t len = this->delta.encode(frame);
+	this->counts.bytes_encoded += len;
+	const char *data = this->delta.buffer();
+
+	long now = now_ns();
+	for (size_t i = 0; i < this->clients.size(); ) {
+		Client *c = &this->clients[i];
+		int ret = 0;
+		if (c->pending_sent < c->pending.size()) {
+			/* Still sending something older: skip this, catch up later */
+			if (!c->need_keyframe) {
+				c->need_keyframe = 1;
+				++this->counts.resynced;
+			}
+			if (now - c->caught_up_ns > stuck_ns) {
+				this->remove(i);
+				++this->counts.dropped;
+				continue;
+			}
+		} else if (c->need_keyframe) {
+			ret = this->catch_up(c);
+		} else if (len) {
+			ret = this->send_to(c, data, len);
+		}
+		if (ret < 0) {
+			this->remove(i);
+			++this->counts.left;
+			continue;
+		}
+		++i;
+	}
+	this->counts.clients = (int) this->clients.size();
+}
+
+void Broadcast_server::serve_until(const struct timespec &deadline)
+{
+	while (1) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long left = (deadline.tv_sec - now.tv_sec) * 1000000000l +
+			(deadline.tv_nsec - now.tv_nsec);
+		if (left <= 0)
+			break;
+		struct epoll_event ev[32];
+		/* Rounded up, so as not to spin for the last fraction of a ms */
+		int n = epoll_wait(this->epoll_fd, ev, 32, (int) ((left + 999999) /
+					1000000));
+		if (n < 0)
+			break;
+		for (int i = 0; i < n; ++i) {
+			int fd = ev[i].data.fd;
+			if (fd == this->listen_fd) {
+				this->accept_clients();
+				continue;
+			}
+			/* Gone already, if something earlier dropped it */
+			int j = (size_t) fd < this->client_of_fd.size() ?
+				this->client_of_fd[fd] : -1;
+			if (j < 0)
+				continue;
+			int gone = (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+			if (gone || this->catch_up(&this->clients[j]) < 0) {
+				this->remove(j);
+				++this->counts.left;
+			}
+		}
+	}
+	/* Frames only go out when something changes, so look here too */
+	long now = now_ns();
+	for (size_t i = 0; i < this->clients.size(); ) {
+		const Client &c = this->clients[i];
+		if (c.pending_sent < c.pending.size() &&
+				now - c.caught_up_ns > stuck_ns) {
+			this->remove(i);
+			++this->counts.dropped;
+		} else {
+			++i;
+		}
+	}
+	this->counts.clients = (int) this->clients.size();
+}
+
+static volatile sig_atomic_t client_running = 1;
+
+static void client_stop(int sig)
+{
+	client_running = 0;
+}
+
+int run_client(const char *path, int out)
+{
+	struct sockaddr_un addr;
+	int fd = -1;
+	if (socket_address(path, &addr) == 0)
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	struct sigaction sa = {};
+	sa.sa_handler = client_stop;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+
+	/* Everything the server sends is meant for the terminal as it is */
+	char buf[65536];
+	while (client_running) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		ssize_t done = 0;
+		while (done < n) {
+			ssize_t w = write(out, buf + done, n - done);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				client_running = 0;
+				break;
+			}
+			done += w;
+		}
+	}
+	close(fd);
+
+	/* Stopped anywhere, so put the colours and cursor back */
+	const char *reset = "\x1b[0m\x1b[?25h\n";
+	if (write(out, reset, strlen(reset)) < 0)
+		return 0;
+	return 0;
+}
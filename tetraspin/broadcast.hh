@@ -0,0 +1,121 @@
+#ifndef BROADCAST_H_I
+#define BROADCAST_H_I
+
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "framebuffer.hh"
+#include "present.hh"
+
+/*
+ * Shows one renderer's frames on any number of terminals: each frame is
+ * encoded once, as what changed since the frame before (the same bytes
+ * Presenter would send a terminal that already showed that), and the same
+ * bytes go to every client connected to a Unix domain socket. Clients are
+ * as thin as can be (see run_client()): they copy what they get to their
+ * terminal.
+ *
+ * Someone joining needs the whole screen first, and so does anyone who
+ * couldn't keep up: a keyframe, the current frame in full on a cleared
+ * screen. Only one is ever encoded per frame, however many clients want it,
+ * and only if anybody does.
+ *
+ * Writes never block. A client that can't take all of a frame keeps the
+ * rest of it, which goes when its socket has room; frames that go out
+ * meanwhile are skipped, and once it has caught up it gets a keyframe.
+ * A client that has been stuck for stuck_ns is dropped.
+ *
+ * All on the thread that renders: serve_until() looks after clients in the
+ * time between frames.
+ */
+class Broadcast_server {
+	public:
+		/* Frames of height x width cells */
+		Broadcast_server(int height, int width);
+		/* Disconnects everyone and removes the socket */
+		~Broadcast_server();
+		/* Listens at path. Returns -1 (errno set) on error. */
+		int listen(const char *path);
+
+		/* Encodes frame and sends it to everyone who is keeping up */
+		void broadcast(Screen_span frame);
+		/*
+		 * Lets clients join and catches them up until deadline
+		 * (CLOCK_MONOTONIC), or until a signal arrives
+		 */
+		void serve_until(const struct timespec &deadline);
+
+		struct Stats {
+			unsigned long frames, keyframes;
+			/* Encoded, and sent to all clients */
+			unsigned long bytes_encoded, bytes_sent;
+			/* Dropped is for falling behind; left, for going away */
+			unsigned long joined, resynced, dropped, left;
+			int clients;
+		};
+		const Stats &stats() const { return counts; }
+
+		/* How long a client can go without taking anything */
+		static const long stuck_ns = 5000000000l;
+
+	private:
+		Broadcast_server(const Broadcast_server &);
+		Broadcast_server &operator=(const Broadcast_server &);
+
+		struct Client {
+			int fd;
+			/* What's left of the last thing that didn't all go */
+			std::vector<char> pending;
+			size_t pending_sent;
+			/* Missed a frame, or just joined */
+			int need_keyframe;
+			/* When it last took everything it was sent */
+			long caught_up_ns;
+			/* Whether epoll is waiting for it to take more */
+			int want_out;
+		};
+
+		void accept_clients();
+		/* Sends len bytes at data, keeping whatever doesn't fit */
+		int send_to(Client *c, const char *data, size_t len);
+		/* Sends what it can of pending, then a keyframe if it needs one */
+		int catch_up(Client *c);
+		/* The keyframe for the current frame, encoded if it isn't yet */
+		void keyframe(const char **data, size_t *len);
+		void watch_out(Client *c, int on);
+		/* Disconnects clients[i] */
+		void remove(size_t i);
+
+		int width, height;
+		/*
+		 * Both only encode (Presenter::encode_only); the bytes go out to
+		 * each client from their buffers. Deltas, each against the frame
+		 * before:
+		 */
+		Presenter delta;
+		/* Keyframes: forgets what it sent every time */
+		Presenter key;
+		/* The current frame, for keyframes */
+		std::vector<Render_symbol> current;
+		int have_frame;
+		/* The frame the keyframe cache is for, and its size */
+		unsigned long key_frame;
+		size_t key_len;
+
+		int listen_fd, epoll_fd;
+		std::string path;
+		std::vector<Client> clients;
+		/* Where each client's fd is in clients, or -1 */
+		std::vector<int> client_of_fd;
+		Stats counts;
+};
+
+/*
+ * Connects to a server listening at path and copies what it sends to fd
+ * until it goes away or a signal says stop. Returns -1 (after saying why on
+ * stderr) if it couldn't connect.
+ */
+int run_client(const char *path, int fd);
+
+#endif
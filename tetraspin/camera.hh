@@ -0,0 +1,78 @@
+#ifndef CAMERA_H_I
+#define CAMERA_H_I
+
+#include <atomic>
+
+#include "vec_ops.hh"
+
+/* Where the camera is and which way it's pointing */
+struct Camera {
+	Vec3 pos;
+	/* Angle to x-axis in xy plane */
+	double xangle;
+	/* Angle to z-axis */
+	double zangle;
+
+	Camera() : pos(0, 0, 0), xangle(0.0), zangle(0.0) {}
+};
+
+/*
+ * Hands Camera values from one thread to another without either waiting: a
+ * sequence lock, where the sequence number is odd while a write is under way
+ * and a reader that sees it change (or odd) just reads again. There can be
+ * any number of readers but only one writer at a time.
+ */
+class Camera_mailbox {
+	public:
+		Camera_mailbox() : seq(0)
+		{
+			for (int i = 0; i < n_fields; ++i)
+				this->fields[i].store(0.0, std::memory_order_relaxed);
+		}
+
+		void store(const Camera &c)
+		{
+			unsigned s = this->seq.load(std::memory_order_relaxed);
+			this->seq.store(s + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			double v[n_fields] = {c.pos.x, c.pos.y, c.pos.z, c.xangle,
+				c.zangle};
+			for (int i = 0; i < n_fields; ++i)
+				this->fields[i].store(v[i], std::memory_order_relaxed);
+			this->seq.store(s + 2, std::memory_order_release);
+		}
+
+		/*
+		 * Copies the latest value into *c. Returns its sequence number,
+		 * which changes whenever a new value is stored.
+		 */
+		unsigned load(Camera *c) const
+		{
+			double v[n_fields];
+			unsigned s0, s1;
+			do {
+				s0 = this->seq.load(std::memory_order_acquire);
+				for (int i = 0; i < n_fields; ++i)
+					v[i] = this->fields[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				s1 = this->seq.load(std::memory_order_relaxed);
+			} while ((s0 & 1) || s0 != s1);
+			c->pos = Vec3(v[0], v[1], v[2]);
+			c->xangle = v[3];
+			c->zangle = v[4];
+			return s0;
+		}
+
+		/* Sequence number of the latest value, without reading it */
+		unsigned version() const
+		{
+			return this->seq.load(std::memory_order_acquire);
+		}
+
+	private:
+		static const int n_fields = 5;
+		std::atomic<unsigned> seq;
+		std::atomic<double> fields[n_fields];
+};
+
+#endif
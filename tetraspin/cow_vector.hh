@@ -0,0 +1,68 @@
+#ifndef COW_VECTOR_H_I
+#define COW_VECTOR_H_I
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * A vector that can also borrow someone else's array instead of having its
+ * own, e.g. part of a mapped file (see scene_cache.hh). Reading a borrowed
+ * array is just reading it; anything that would change it first copies it
+ * into the vector's own storage, after which the borrowed memory is no
+ * longer used. Whoever lends memory has to keep it there for as long as it
+ * is borrowed.
+ */
+template <typename T>
+class Cow_vector {
+	public:
+		Cow_vector() : ext(0), n_ext(0) {}
+
+		/* Use the n Ts at p rather than anything of our own */
+		void borrow(const T *p, size_t n)
+		{
+			own.clear();
+			own.shrink_to_fit();
+			ext = p;
+			n_ext = n;
+		}
+		int borrowed() const { return ext != 0; }
+
+		size_t size() const { return ext ? n_ext : own.size(); }
+		bool empty() const { return size() == 0; }
+		const T *data() const { return ext ? ext : own.data(); }
+		T *data() { return mine().data(); }
+		const T &operator[](size_t i) const { return data()[i]; }
+		T &operator[](size_t i) { return mine()[i]; }
+		const T *begin() const { return data(); }
+		const T *end() const { return data() + size(); }
+		T *begin() { return data(); }
+		T *end() { return data() + size(); }
+
+		void push_back(const T &v) { mine().push_back(v); }
+		void reserve(size_t n) { mine().reserve(n); }
+		void resize(size_t n) { mine().resize(n); }
+		void clear()
+		{
+			ext = 0;
+			n_ext = 0;
+			own.clear();
+		}
+
+	private:
+		/* Our own storage, taking a copy of what was borrowed first */
+		std::vector<T> &mine()
+		{
+			if (ext) {
+				own.assign(ext, ext + n_ext);
+				ext = 0;
+				n_ext = 0;
+			}
+			return own;
+		}
+
+		std::vector<T> own;
+		const T *ext;
+		size_t n_ext;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event_loop.hh"
+
+Event_loop::Event_loop(int input_fd, long period_ns)
+	: input_fd(input_fd), period_ns(0), handed_over(0), escape_waited(0)
+{
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = this->timer_fd;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->timer_fd, &ev);
+	if (this->input_fd >= 0) {
+		ev.data.fd = this->input_fd;
+		if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->input_fd, &ev) < 0)
+			this->input_fd = -1;
+	}
+	this->set_period(period_ns);
+}
+
+Event_loop::~Event_loop()
+{
+	close(this->timer_fd);
+	close(this->epoll_fd);
+}
+
+void Event_loop::set_period(long period_ns)
+{
+	if (period_ns == this->period_ns)
+		return;
+	this->period_ns = period_ns;
+	struct itimerspec t = {};
+	t.it_interval.tv_sec = period_ns / 1000000000l;
+	t.it_interval.tv_nsec = period_ns % 1000000000l;
+	t.it_value = t.it_interval;
+	timerfd_settime(this->timer_fd, 0, &t, 0);
+}
+
+void Event_loop::read_input()
+{
+	char buf[4096];
+	ssize_t n = read(this->input_fd, buf, sizeof(buf));
+	if (n > 0) {
+		this->decoder.feed(buf, n, &this->key_queue);
+	} else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+		/* Readable but nothing there: the other end has gone */
+		epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->input_fd, 0);
+		this->input_fd = -1;
+		this->decoder.flush(&this->key_queue);
+	}
+}
+
+int Event_loop::wait_frame()
+{
+	if (this->handed_over) {
+		this->key_queue.clear();
+		this->handed_over = 0;
+	}
+	while (1) {
+		struct epoll_event ev[2];
+		int n = epoll_wait(this->epoll_fd, ev, 2, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return 0;
+		uint64_t ticks = 0;
+		for (int i = 0; i < n; ++i) {
+			if (ev[i].data.fd == this->timer_fd) {
+				if (read(this->timer_fd, &ticks, sizeof(ticks)) < 0)
+					ticks = 0;
+			} else if (this->input_fd >= 0) {
+				this->read_input();
+			}
+		}
+		if (!ticks)
+			continue;
+
+		/*
+		 * An ESC that has had a whole frame for the rest of a sequence to
+		 * turn up was the Escape key
+		 */
+		if (!this->decoder.pending())
+			this->escape_waited = 0;
+		else if (this->escape_waited++)
+			this->decoder.flush(&this->key_queue);
+		this->handed_over = 1;
+		return (int) ticks;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef EVENT_LOOP_H_I
+#define EVENT_LOOP_H_I
+
+#include <vector>
+
+#include "input.hh"
+
+/*
+ * Waits for two things at once with epoll: keys on the input and ticks of a
+ * timerfd frame clock. Input is read in bulk as soon as it arrives and
+ * decoded into a queue of keys that is handed over at the next tick, so a
+ * key takes at most one frame to act on, and the number of syscalls goes
+ * with how much is typed rather than with how often we look.
+ */
+class Event_loop {
+	public:
+		/* Reads keys from input_fd (-1 for none) and ticks every period_ns */
+		Event_loop(int input_fd, long period_ns);
+		~Event_loop();
+		/* Changes how often it ticks, from now on */
+		void set_period(long period_ns);
+		/*
+		 * Waits for the next tick, collecting keys meanwhile; signals don't
+		 * cut the wait short. Returns how many ticks there have been since
+		 * last time (more than 1 means frames were missed), or 0 if epoll
+		 * failed, in which case the keys so far are kept for the next tick.
+		 */
+		int wait_frame();
+		/* Keys that arrived before the last tick, until the next call */
+		const std::vector<Key_event> &keys() const { return key_queue; }
+		/* Whether the input has gone away */
+		int input_closed() const { return input_fd < 0; }
+
+	private:
+		Event_loop(const Event_loop &);
+		Event_loop &operator=(const Event_loop &);
+
+		void read_input();
+
+		int epoll_fd, timer_fd, input_fd;
+		long period_ns;
+		Key_decoder decoder;
+		std::vector<Key_event> key_queue;
+		/* key_queue went out with a tick, so the next call starts afresh */
+		int handed_over;
+		/* An ESC has been waiting for the rest of its sequence for a tick */
+		int escape_waited;
+};
+
+#endif
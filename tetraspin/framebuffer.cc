@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "framebuffer.hh"
+
+/* Palette index to ANSI code; backgrounds are these plus 10 */
+static const unsigned char fg_codes[n_colours] = {
+	0, 30, 31, 32, 33, 34, 35, 36, 37, 90, 91, 92, 93, 94, 95, 96, 97
+};
+
+/* ANSI code to palette index: 30..37 are 1..8, 90..97 are 9..16 */
+static unsigned fg_index(unsigned code)
+{
+	return code == 0 ? 0 : code < 90 ? code - 29 : code - 81;
+}
+
+Render_symbol::Render_symbol(char c, enum fg_colour f,
+		enum bg_colour b)
+{
+	unsigned pair = fg_index(f) * n_colours + (b ? fg_index(b - 10) : 0);
+	bits = (unsigned char) c | pair << 8;
+}
+
+unsigned char Render_symbol::get_fg() const
+{
+	return fg_codes[this->colours() / n_colours];
+}
+
+unsigned char Render_symbol::get_bg() const
+{
+	unsigned i = this->colours() % n_colours;
+	return i ? fg_codes[i] + 10 : 0;
+}
+
+static void build_sgr_table(Sgr_sequence *table)
+{
+	for (int f = 0; f < n_colours; ++f) {
+		for (int b = 0; b < n_colours; ++b) {
+			/*
+			 * Can get away with e.g. \x1b[0;41m, but not \x1b[41;0m as a
+			 * colour code
+			 */
+			char buf[32];
+			int len = snprintf(buf, sizeof(buf), "\x1b[0");
+			if (f)
+				len += snprintf(buf + len, sizeof(buf) - len, ";%d",
+						fg_codes[f]);
+			if (b)
+				len += snprintf(buf + len, sizeof(buf) - len, ";%d",
+						fg_codes[b] + 10);
+			buf[len++] = 'm';
+			Sgr_sequence *s = &table[f * n_colours + b];
+			memset(s->bytes, 0, sizeof(s->bytes));
+			memcpy(s->bytes, buf, len);
+			s->len = len;
+		}
+	}
+}
+
+const Sgr_sequence *sgr_table()
+{
+	static Sgr_sequence table[n_colour_pairs];
+	static int built = (build_sgr_table(table), 1);
+	(void) built;
+	return table;
+}
+
+std::string Render_symbol::get_string() const
+{
+	const Sgr_sequence &s = sgr_table()[this->colours()];
+	return std::string(s.bytes, s.len) + this->get_char() + "\x1b[0m";
+}
+
+template <typename D>
+Framebuffer<D>::Framebuffer(int height, int width)
+	: width(width), height(height),
+	hiz_tiles_x((width + hiz_w - 1) / hiz_w),
+	hiz_tiles_y((height + hiz_h - 1) / hiz_h),
+	symbols((size_t) width * height, Render_symbol(' ', fg_none, bg_none)),
+	depth((size_t) width * height, far())
+{
+	hiz.assign((size_t) hiz_tiles_x * hiz_tiles_y,
+			std::numeric_limits<double>::infinity());
+	hiz_stale.assign(hiz.size(), 0);
+	/* Nothing drawn yet, so nothing to clear */
+	dirty_y0 = height;
+	dirty_y1 = -1;
+	dirty_x0 = width;
+	dirty_x1 = -1;
+}
+
+template <typename D>
+void Framebuffer<D>::resize(int height, int width)
+{
+	this->width = width;
+	this->height = height;
+	hiz_tiles_x = (width + hiz_w - 1) / hiz_w;
+	hiz_tiles_y = (height + hiz_h - 1) / hiz_h;
+	size_t cells = (size_t) width * height;
+	resize_reserved(&symbols, cells);
+	resize_reserved(&depth, cells);
+	std::fill(symbols.begin(), symbols.end(), Render_symbol(' ', fg_none,
+				bg_none));
+	std::fill(depth.begin(), depth.end(), far());
+	resize_reserved(&hiz, (size_t) hiz_tiles_x * hiz_tiles_y);
+	resize_reserved(&hiz_stale, hiz.size());
+	std::fill(hiz.begin(), hiz.end(), std::numeric_limits<double>::infinity());
+	std::fill(hiz_stale.begin(), hiz_stale.end(), 0);
+	dirty_y0 = height;
+	dirty_y1 = -1;
+	dirty_x0 = width;
+	dirty_x1 = -1;
+}
+
+template <typename D>
+void Framebuffer<D>::clear()
+{
+	if (dirty_y0 > dirty_y1)
+		return;
+
+	/*
+	 * Only the part that has been drawn on needs resetting. Scenes rarely
+	 * fill the whole screen, so this is usually a good deal less than all of
+	 * it, and if whole rows were touched the rectangle is one contiguous
+	 * block.
+	 */
+	const Render_symbol blank(' ', fg_none, bg_none);
+	const D far = this->far();
+	const double hiz_far = std::numeric_limits<double>::infinity();
+	if (dirty_x0 == 0 && dirty_x1 == width - 1) {
+		size_t from = (size_t) dirty_y0 * width;
+		size_t to = (size_t) (dirty_y1 + 1) * width;
+		std::fill(symbols.begin() + from, symbols.begin() + to, blank);
+		std::fill(depth.begin() + from, depth.begin() + to, far);
+	} else {
+		for (int y = dirty_y0; y <= dirty_y1; ++y) {
+			size_t from = (size_t) y * width + dirty_x0;
+			size_t to = (size_t) y * width + dirty_x1 + 1;
+			std::fill(symbols.begin() + from, symbols.begin() + to, blank);
+			std::fill(depth.begin() + from, depth.begin() + to, far);
+		}
+	}
+
+	/* Tiles outside the rectangle were empty and still are */
+	for (int ty = dirty_y0 / hiz_h; ty <= dirty_y1 / hiz_h; ++ty) {
+		for (int tx = dirty_x0 / hiz_w; tx <= dirty_x1 / hiz_w; ++tx) {
+			hiz[ty * hiz_tiles_x + tx] = hiz_far;
+			hiz_stale[ty * hiz_tiles_x + tx] = 0;
+		}
+	}
+
+	dirty_y0 = height;
+	dirty_y1 = -1;
+	dirty_x0 = width;
+	dirty_x1 = -1;
+}
+
+template <typename D>
+void Framebuffer<D>::clear_rect(int y0, int y1, int x0, int x1)
+{
+	const Render_symbol blank(' ', fg_none, bg_none);
+	const D far = this->far();
+	const double hiz_far = std::numeric_limits<double>::infinity();
+	for (int y = y0; y <= y1; ++y) {
+		size_t from = (size_t) y * width + x0;
+		size_t to = (size_t) y * width + x1 + 1;
+		std::fill(symbols.begin() + from, symbols.begin() + to, blank);
+		std::fill(depth.begin() + from, depth.begin() + to, far);
+	}
+
+	/*
+	 * Tiles wholly inside are now empty; ones only partly inside still have
+	 * whatever is in the rest of them, so have to be worked out again
+	 */
+	for (int ty = y0 / hiz_h; ty <= y1 / hiz_h; ++ty) {
+		for (int tx = x0 / hiz_w; tx <= x1 / hiz_w; ++tx) {
+			size_t t = (size_t) ty * hiz_tiles_x + tx;
+			int inside = ty * hiz_h >= y0 &&
+				std::min((ty + 1) * hiz_h, height) - 1 <= y1 &&
+				tx * hiz_w >= x0 &&
+				std::min((tx + 1) * hiz_w, width) - 1 <= x1;
+			if (inside) {
+				hiz[t] = hiz_far;
+				hiz_stale[t] = 0;
+			} else {
+				hiz_stale[t] = 1;
+			}
+		}
+	}
+}
+
+template <typename D>
+double Framebuffer<D>::tile_max_depth(int ty, int tx)
+{
+	size_t t = (size_t) ty * hiz_tiles_x + tx;
+	if (!hiz_stale[t])
+		return hiz[t];
+
+	D m = 0;
+	int y1 = std::min((ty + 1) * hiz_h, height);
+	int x1 = std::min((tx + 1) * hiz_w, width);
+	for (int y = ty * hiz_h; y < y1; ++y) {
+		const D *d = &depth[(size_t) y * width];
+		for (int x = tx * hiz_w; x < x1; ++x)
+			m = std::max(m, d[x]);
+	}
+	hiz[t] = m;
+	hiz_stale[t] = 0;
+	return hiz[t];
+}
+
+template <typename D>
+void Framebuffer<D>::depth_changed(int y0, int y1, int x0, int x1)
+{
+	for (int ty = y0 / hiz_h; ty <= y1 / hiz_h; ++ty)
+		for (int tx = x0 / hiz_w; tx <= x1 / hiz_w; ++tx)
+			hiz_stale[ty * hiz_tiles_x + tx] = 1;
+}
+
+template <typename D>
+Screen_span Framebuffer<D>::symbol_span() const
+{
+	Screen_span s = {symbols.data(), width, height};
+	return s;
+}
+
+template <typename D>
+Grid_span<const D> Framebuffer<D>::depth_span() const
+{
+	Grid_span<const D> s = {depth.data(), width, height};
+	return s;
+}
+
+/* The depth formats the raster paths use */
+template class Framebuffer<double>;
+template class Framebuffer<float>;
+template class Framebuffer<int32_t>;
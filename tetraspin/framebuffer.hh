@@ -0,0 +1,204 @@
+#ifndef FRAMEBUFFER_H_I
+#define FRAMEBUFFER_H_I
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+/* These are the colour codes for ANSI terminal colours */
+enum fg_colour {
+	fg_none = 0,
+	fg_black = 30,
+	fg_red = 31,
+	fg_green = 32,
+	fg_yellow = 33,
+	fg_blue = 34,
+	fg_magenta = 35,
+	fg_cyan = 36,
+	fg_white = 37,
+	/* Bright colours */
+	fg_b_black = 90,
+	fg_b_red = 91,
+	fg_b_green = 92,
+	fg_b_yellow = 93,
+	fg_b_blue = 94,
+	fg_b_magenta = 95,
+	fg_b_cyan = 96,
+	fg_b_white = 97
+};
+
+enum bg_colour {
+	bg_none = 0,
+	bg_black = 40,
+	bg_red = 41,
+	bg_green = 42,
+	bg_yellow = 43,
+	bg_blue = 44,
+	bg_magenta = 45,
+	bg_cyan = 46,
+	bg_white = 47,
+	/* Bright colours */
+	bg_b_black = 100,
+	bg_b_red = 101,
+	bg_b_green = 102,
+	bg_b_yellow = 103,
+	bg_b_blue = 104,
+	bg_b_magenta = 105,
+	bg_b_cyan = 106,
+	bg_b_white = 107
+};
+
+/*
+ * The palette: none plus the 16 colours above, each way round. A foreground
+ * and background together make a colour pair, numbered
+ * fg index * n_colours + bg index, so pair 0 is no colour at all.
+ */
+static const int n_colours = 17;
+static const int n_colour_pairs = n_colours * n_colours;
+
+/*
+ * The escape sequence that sets a colour pair (resetting first, as
+ * fg_none/bg_none need), padded so that it can always be copied in one go
+ */
+struct Sgr_sequence {
+	unsigned char len;
+	char bytes[15];
+};
+
+/* Sequences for every colour pair, worked out the first time it's called */
+const Sgr_sequence *sgr_table();
+
+/*
+ * Describes what to draw on the screen when a shape is rendered: a whole
+ * cell is one 32-bit word, the character in the low byte and its colour pair
+ * above it, so that cells are copied and compared as plain integers.
+ */
+class Render_symbol {
+	public:
+		Render_symbol(char c = ' ', enum fg_colour f = fg_none,
+				enum bg_colour b = bg_none);
+		std::string get_string() const;
+		char get_char() const { return (char) (bits & 0xff); }
+		/* The colour pair, an index into sgr_table() */
+		unsigned colours() const { return bits >> 8; }
+		/* ANSI codes, as in fg_colour/bg_colour */
+		unsigned char get_fg() const;
+		unsigned char get_bg() const;
+		bool operator==(const Render_symbol &o) const { return bits == o.bits; }
+		bool operator!=(const Render_symbol &o) const { return bits != o.bits; }
+	private:
+		uint32_t bits;
+};
+
+/*
+ * A row-major view of a 2D grid, so that callers can still write a[y][x]
+ * without there being an array of row pointers behind it.
+ */
+template <typename T>
+struct Grid_span {
+	T *data;
+	int width, height;
+
+	T *operator[](int y) const { return data + (size_t) y * width; }
+};
+
+typedef Grid_span<const Render_symbol> Screen_span;
+typedef Grid_span<const double> Depth_span;
+
+/*
+ * Makes v n long. Past its capacity, it makes room for half as much again,
+ * so that a terminal being dragged bigger a column at a time doesn't mean a
+ * reallocation (and a copy) every step; getting smaller never frees anything.
+ */
+template <typename T>
+void resize_reserved(std::vector<T> *v, size_t n)
+{
+	if (n > v->capacity())
+		v->reserve(n + n / 2);
+	v->resize(n);
+}
+
+/*
+ * What render() draws into. The symbols and their distances live in
+ * separate contiguous planes: output only ever wants the symbols, and the
+ * depth test only ever wants the distances, so neither drags the other
+ * through the cache.
+ * Distances are stored as D, whatever the raster path works in (see
+ * raster.hh): double, float or fixed point.
+ * Rows are ordered top to bottom, as that is convenient for output.
+ */
+template <typename D>
+class Framebuffer {
+	public:
+		Framebuffer(int height, int width);
+		/*
+		 * Makes it height x width, and blank. Only allocates if it has never
+		 * been that big (see resize_reserved()).
+		 */
+		void resize(int height, int width);
+		/*
+		 * Resets everything that has been drawn on since the last clear to
+		 * blank and infinitely far away
+		 */
+		void clear();
+		/*
+		 * Resets just rows y0..y1 and columns x0..x1 (inclusive), whether
+		 * or not they have been drawn on
+		 */
+		void clear_rect(int y0, int y1, int x0, int x1);
+		/*
+		 * Marks rows y0..y1 and columns x0..x1 (inclusive) as about to be
+		 * drawn on, so that clear() knows to reset them
+		 */
+		void touch(int y0, int y1, int x0, int x1)
+		{
+			if (y0 < dirty_y0) dirty_y0 = y0;
+			if (y1 > dirty_y1) dirty_y1 = y1;
+			if (x0 < dirty_x0) dirty_x0 = x0;
+			if (x1 > dirty_x1) dirty_x1 = x1;
+		}
+		Render_symbol *row(int y) { return &symbols[(size_t) y * width]; }
+		D *depth_row(int y) { return &depth[(size_t) y * width]; }
+		Screen_span symbol_span() const;
+		Grid_span<const D> depth_span() const;
+		/* What an unwritten cell's distance is: farther than anything */
+		static D far()
+		{
+			return std::numeric_limits<D>::has_infinity ?
+				std::numeric_limits<D>::infinity() :
+				std::numeric_limits<D>::max();
+		}
+
+		/*
+		 * Coarse depth buffer: the farthest distance drawn in each
+		 * hiz_h x hiz_w tile, so that whole tiles can be checked at once.
+		 */
+		static const int hiz_w = 8;
+		static const int hiz_h = 8;
+		/*
+		 * Farthest distance in tile (ty, tx); far() (or more) if any of it
+		 * is empty. Worked out lazily after the tile has been drawn on.
+		 * Different tiles can be used from different threads.
+		 */
+		double tile_max_depth(int ty, int tx);
+		/*
+		 * Marks the tiles covering rows y0..y1 and columns x0..x1 as
+		 * having had distances written
+		 */
+		void depth_changed(int y0, int y1, int x0, int x1);
+
+		int width, height;
+		int hiz_tiles_x, hiz_tiles_y;
+	private:
+		std::vector<Render_symbol> symbols;
+		/* Everything should overwrite an unwritten cell */
+		std::vector<D> depth;
+		/* Bounding rectangle of what has been drawn since the last clear */
+		int dirty_y0, dirty_y1, dirty_x0, dirty_x1;
+		std::vector<double> hiz;
+		/* Tiles whose entry in hiz is out of date */
+		std::vector<unsigned char> hiz_stale;
+};
+
+#endif
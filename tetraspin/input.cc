@@ -1,19 +1,26 @@
 #include <termios.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "input.hh"
 #include "vec_ops.hh"
 
-static void move_lateral(Renderer *rend, double distance);
-static void move_vertical(Renderer *rend, double distance);
-static void move_forward_backward(Renderer *rend, double distance);
+static void move_lateral(Camera *cam, double distance);
+static void move_vertical(Camera *cam, double distance);
+static void move_forward_backward(Camera *cam, double distance);
+
+static struct termios original;
+static int have_original = 0;
 
 void input_setup()
 {
 	struct termios t_conf;
-	tcgetattr(0, &t_conf);
+	if (tcgetattr(0, &t_conf) < 0)
+		return;
+	original = t_conf;
+	have_original = 1;
 	/* Disable canonical mode to read input character by character */
 	t_conf.c_lflag &= ~ICANON;
 	/* Disable input echoing */
@@ -25,77 +32,179 @@ void input_setup()
 	tcsetattr(0, TCSANOW, &t_conf);
 }
 
+void input_restore()
+{
+	if (have_original)
+		tcsetattr(0, TCSANOW, &original);
+}
+
+void Key_decoder::feed(const char *buf, size_t n, std::vector<Key_event> *out)
+{
+	for (size_t i = 0; i < n; ++i) {
+		char c = buf[i];
+		if (!this->n_pending) {
+			if (c == 0x1b) {
+				this->pending_bytes[this->n_pending++] = c;
+			} else {
+				Key_event k = {key_char, c};
+				out->push_back(k);
+			}
+			continue;
+		}
+
+		if (this->n_pending == 1) {
+			/* ESC [ is CSI, ESC O is SS3; anything else was Escape */
+			if (c == '[' || c == 'O') {
+				this->pending_bytes[this->n_pending++] = c;
+			} else {
+				this->n_pending = 0;
+				Key_event k = {key_escape, 0};
+				out->push_back(k);
+				/* Go round again for c on its own */
+				--i;
+			}
+			continue;
+		}
+
+		/*
+		 * CSI has parameter and intermediate bytes then a final byte
+		 * from @ to ~; SS3 is just the final byte
+		 */
+		if (c >= 0x40 && c <= 0x7e) {
+			this->sequence_done(c, out);
+		} else if (this->pending_bytes[1] == 'O' || c < 0x20
+				|| this->n_pending == max_pending) {
+			/* Not something we understand; drop it */
+			this->n_pending = 0;
+			Key_event k = {key_unknown, 0};
+			out->push_back(k);
+		} else {
+			this->pending_bytes[this->n_pending++] = c;
+		}
+	}
+}
+
+void Key_decoder::sequence_done(char final, std::vector<Key_event> *out)
+{
+	Key_event k = {key_unknown, 0};
+	switch (final) {
+		case 'A': k.code = key_up; break;
+		case 'B': k.code = key_down; break;
+		case 'C': k.code = key_right; break;
+		case 'D': k.code = key_left; break;
+		case 'H': k.code = key_home; break;
+		case 'F': k.code = key_end; break;
+		case '~': {
+			/* ESC [ n ~, n being which key (and maybe ; modifiers) */
+			int n = 0;
+			for (int i = 2; i < this->n_pending; ++i) {
+				char d = this->pending_bytes[i];
+				if (d < '0' || d > '9')
+					break;
+				n = n * 10 + (d - '0');
+			}
+			static const enum Key_code tilde_keys[] = {key_unknown, key_home,
+				key_insert, key_delete, key_end, key_page_up, key_page_down,
+				key_home, key_end};
+			if (n < (int) (sizeof(tilde_keys) / sizeof(tilde_keys[0])))
+				k.code = tilde_keys[n];
+			break;
+		}
+	}
+	this->n_pending = 0;
+	out->push_back(k);
+}
 
-void handle_input(Renderer *renderer)
+void Key_decoder::flush(std::vector<Key_event> *out)
 {
-	/* Check for user input */
-	char in = 0;
-   	read(0, &in, 1);
-	while (in) {
-		renderer->updated = true;
-		switch (in) {
+	if (this->n_pending == 1) {
+		Key_event k = {key_escape, 0};
+		out->push_back(k);
+	}
+	this->n_pending = 0;
+}
+
+int apply_keys(Camera *camera, const std::vector<Key_event> &keys)
+{
+	int what = 0;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		int moved = 1;
+		const Key_event &k = keys[i];
+		/* Characters are 0-255, other keys come after */
+		switch (k.code == key_char ? (unsigned char) k.ch : 256 + k.code) {
 			case 'a':
-				move_lateral(renderer, -0.2);
+				move_lateral(camera, -0.2);
 				break;
 			case 'd':
-				move_lateral(renderer, 0.2);
+				move_lateral(camera, 0.2);
 				break;
 			case 'w':
-				move_vertical(renderer, 0.2);
+				move_vertical(camera, 0.2);
 				break;
 			case 's':
-				move_vertical(renderer, -0.2);
+				move_vertical(camera, -0.2);
 				break;
 			case 'q':
-				move_forward_backward(renderer, 0.2);
+			case 256 + key_up:
+				move_forward_backward(camera, 0.2);
 				break;
 			case 'z':
-				move_forward_backward(renderer, -0.2);
+			case 256 + key_down:
+				move_forward_backward(camera, -0.2);
 				break;
 			case 'e':
-				renderer->camera_xangle += 0.02;
+			case 256 + key_left:
+				camera->xangle += 0.02;
 				break;
 			case 'r':
-				renderer->camera_xangle -= 0.02;
+			case 256 + key_right:
+				camera->xangle -= 0.02;
 				break;
 			case 'f':
-				renderer->camera_zangle -= 0.02;
+				camera->zangle -= 0.02;
 				break;
 			case 'v':
-				renderer->camera_zangle += 0.02;
+				camera->zangle += 0.02;
+				break;
+			case ' ':
+				what ^= keys_toggle_spin;
+				moved = 0;
+				break;
+			case 256 + key_escape:
+				what |= keys_quit;
+				moved = 0;
+				break;
+			default:
+				moved = 0;
 				break;
-
 		}
-
-		in = 0;
-		read(0, &in, 1);
+		if (moved)
+			what |= keys_moved;
 	}
+	return what;
 }
 
 
-static void move_lateral(Renderer *rend, double distance)
+static void move_lateral(Camera *cam, double distance)
 {
-	std::vector<double> lat_vec({cos(rend->camera_xangle),
-			sin(rend->camera_xangle), 0});
+	Vec3 lat_vec(cos(cam->xangle), sin(cam->xangle), 0);
 	lat_vec = vec_mult(lat_vec, distance);
-	rend->camera_pos = vec_add(rend->camera_pos, lat_vec);
+	cam->pos = vec_add(cam->pos, lat_vec);
 }
 
-static void move_forward_backward(Renderer *rend, double distance)
+static void move_forward_backward(Camera *cam, double distance)
 {
-	std::vector<double> fb_vec({-1.0 * sin(rend->camera_xangle),
-			cos(rend->camera_xangle), 0});
+	Vec3 fb_vec(-1.0 * sin(cam->xangle), cos(cam->xangle), 0);
 	fb_vec = vec_mult(fb_vec, distance);
-	rend->camera_pos = vec_add(rend->camera_pos, fb_vec);
+	cam->pos = vec_add(cam->pos, fb_vec);
 }
 
-static void move_vertical(Renderer *rend, double distance)
+static void move_vertical(Camera *cam, double distance)
 {
-	std::vector<double> vert_vec({-sin(rend->camera_zangle) *
-			sin(rend->camera_xangle),
-			sin(rend->camera_zangle) * cos(rend->camera_xangle),
-			cos(rend->camera_zangle)});
+	Vec3 vert_vec(-sin(cam->zangle) * sin(cam->xangle),
+			sin(cam->zangle) * cos(cam->xangle),
+			cos(cam->zangle));
 
 	vert_vec = vec_mult(vert_vec, distance);
-	rend->camera_pos = vec_add(rend->camera_pos, vert_vec);
+	cam->pos = vec_add(cam->pos, vert_vec);
 }
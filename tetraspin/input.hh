@@ -1,12 +1,71 @@
 #ifndef INPUT_H_I
 #define INPUT_H_I
 
-#include "render.hh"
+#include <cstddef>
+#include <vector>
+
+#include "camera.hh"
 
 /* sets up terminal for input */
 void input_setup();
+/* Puts the terminal back the way input_setup() found it */
+void input_restore();
+
+enum Key_code {
+	key_char,
+	key_up, key_down, key_left, key_right,
+	key_home, key_end, key_page_up, key_page_down, key_insert, key_delete,
+	key_escape,
+	/* An escape sequence we don't know */
+	key_unknown
+};
+
+struct Key_event {
+	enum Key_code code;
+	/* The character, for key_char */
+	char ch;
+};
+
+/*
+ * Turns what the terminal sends into keys. Keys like the arrows arrive as
+ * escape sequences of several bytes, which may be split across reads, so
+ * anything unfinished is kept for next time. The Escape key is a lone ESC,
+ * which can only be told apart from the start of a sequence by nothing else
+ * turning up, hence flush().
+ */
+class Key_decoder {
+	public:
+		Key_decoder() : n_pending(0) {}
+		/* Decodes n bytes, adding the keys to *out */
+		void feed(const char *buf, size_t n, std::vector<Key_event> *out);
+		/* Whether it's in the middle of a sequence */
+		int pending() const { return n_pending > 0; }
+		/* Nothing more is coming: a lone ESC was Escape, the rest is junk */
+		void flush(std::vector<Key_event> *out);
+	private:
+		void sequence_done(char final, std::vector<Key_event> *out);
+
+		/* The longest sequence we bother with */
+		static const int max_pending = 16;
+		char pending_bytes[max_pending];
+		int n_pending;
+};
+
+/* What keys did to the camera */
+enum {keys_moved = 1, keys_toggle_spin = 2, keys_quit = 4};
 
-/* Provides non-blocking input handling */
-void handle_input(Renderer *renderer);
+/*
+ * Moves camera as keys say and returns the keys_* flags for what happened.
+ *
+ * Controls:
+ * Camera up/down: W/S
+ * Camera left/right: A/D
+ * Camera forward/back: Q/Z or up/down arrows
+ * Rotate camera left/right: E/R or left/right arrows
+ * Rotate camera up/down: F/V
+ * Stop or start spinning: space
+ * Quit: Escape
+ */
+int apply_keys(Camera *camera, const std::vector<Key_event> &keys);
 
 #endif
@@ -1,64 +1,474 @@
-#include <iostream>
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
 
+#include "broadcast.hh"
+#include "event_loop.hh"
+#include "pipeline.hh"
+#include "present.hh"
+#include "profile.hh"
 #include "render.hh"
+#include "scene_cache.hh"
+#include "world.hh"
 #include "world_setup.hh"
 #include "input.hh"
 
+/* Controls: see apply_keys() in input.hh */
+
+static volatile sig_atomic_t running = 1;
+
+/* Go round centre, turning as we go so as to keep facing it */
+static void spin(Camera *cam, Vec3 centre, double omega)
+{
+	double dx = cam->pos.x - centre.x;
+	double dy = cam->pos.y - centre.y;
+	double c = cos(-omega);
+	double s = sin(-omega);
+	cam->pos.x = centre.x + dx * c - dy * s;
+	cam->pos.y = centre.y + dx * s + dy * c;
+	cam->xangle -= omega;
+}
+
+/* Leave the loop so that the terminal gets tidied up */
+static void stop(int sig)
+{
+	running = 0;
+}
+
+static volatile sig_atomic_t resized = 0;
+
+static void window_changed(int sig)
+{
+	resized = 1;
+}
+
+/*
+ * The terminal's size, rounded down to even numbers for convenience, with a
+ * row kept free so the terminal doesn't scroll when the last one is written.
+ * Returns 0 if fd isn't a terminal (or is a silly size).
+ */
+static int terminal_size(int fd, int *rows, int *cols)
+{
+	struct winsize ws;
+	if (ioctl(fd, TIOCGWINSZ, &ws) < 0 || ws.ws_row < 3 || ws.ws_col < 2)
+		return 0;
+	*rows = (ws.ws_row - 1) & ~1;
+	*cols = ws.ws_col & ~1;
+	return 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p] [-f fps] [-r double|float|fixed] [-S] "
+			"[-J summary] [-T trace] [-g WxH] [-M megabytes] "
+			"[-w cache | -L socket] [mesh, cache or world]\n"
+			"       %s -C socket\n       %s -W world\n", prog, prog, prog);
+	exit(1);
+}
+
+static long now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000l + now.tv_nsec;
+}
+
+/* Brings in the part of the world, if any, around where camera is */
+static void stream(World_stream *world, Renderer *renderer,
+		const Camera &camera)
+{
+	if (!world)
+		return;
+	world->update(renderer, camera.pos, now_ns());
+}
+
+/*
+ * Renders for whoever connects to path (see broadcast.hh) instead of for
+ * this terminal, going round centre the way main does when left alone
+ */
+static int serve(Renderer *renderer, const char *path, double fps,
+		Camera camera, Vec3 centre, double omega, World_stream *world)
+{
+	Broadcast_server server(renderer->screen_y, renderer->screen_x);
+	if (server.listen(path) < 0) {
+		perror(path);
+		return 1;
+	}
+	long period = (long) (1e9 / fps);
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (running) {
+		deadline.tv_nsec += period;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+		deadline.tv_nsec %= 1000000000l;
+		/* If we've fallen well behind, start again from now */
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - deadline.tv_sec) * 1000000000l +
+				(now.tv_nsec - deadline.tv_nsec) > period)
+			deadline = now;
+		/* Viewers come and go, and catch up, in between frames */
+		server.serve_until(deadline);
+		if (!running)
+			break;
+
+		spin(&camera, centre, omega);
+		renderer->set_camera(camera);
+		stream(world, renderer, camera);
+		Screen_span frame = renderer->render();
+		if (renderer->updated)
+			server.broadcast(frame);
+	}
+
+	const Broadcast_server::Stats &s = server.stats();
+	fprintf(stderr, "%lu frames, %lu keyframes, %lu bytes encoded, %lu sent; "
+			"%lu viewers joined, %lu left, %lu resynced, %lu dropped\n",
+			s.frames, s.keyframes, s.bytes_encoded, s.bytes_sent, s.joined,
+			s.left, s.resynced, s.dropped);
+	if (world) {
+		const World_stream::Stats &w = world->stats();
+		fprintf(stderr, "%d of %d chunks in memory (%.1f MB), %d drawn; "
+				"%lu read (%.2f ms each, %.2f at most), %lu thrown out, "
+				"%lu read for nothing\n", w.loaded, w.chunks,
+				w.loaded_bytes / 1048576.0, w.shown, w.reads,
+				w.reads ? w.read_ns * 1e-6 / w.reads : 0.0,
+				w.max_read_ns * 1e-6, w.evictions, w.wasted);
+		if (w.failed)
+			fprintf(stderr, "%lu reads failed: %s\n", w.failed,
+					w.error.c_str());
+	}
+	return 0;
+}
+
+/* What the profiler wants to know about the frame just drawn */
+static Profile_counters counters(const Render_stats &s, size_t bytes)
+{
+	Profile_counters c;
+	c.triangles_submitted = s.triangles_submitted;
+	c.triangles_culled = s.triangles_culled + s.backfaces_culled +
+		s.triangles_occluded;
+	c.triangles_rasterized = s.triangles_drawn;
+	c.cells_tested = s.cells_tested;
+	c.depth_rejects = s.depth_rejects;
+	c.bytes_written = bytes;
+	return c;
+}
+
 /*
- * Controls:
- * Camera up: W
- * Camera down: S
- * Camera left: A
- * Camera right: D
- * Rotate camera left/right: E/R
- * Rotate camera up/down: F/V
+ * Copies frame into *copy with text over its bottom row, in reverse video
+ * so it can't be mistaken for the scene
  */
+static Screen_span with_overlay(Screen_span frame, const char *text,
+		std::vector<Render_symbol> *copy)
+{
+	copy->assign(frame.data, frame.data + (size_t) frame.width * frame.height);
+	Render_symbol *row = copy->data() +
+		(size_t) (frame.height - 1) * frame.width;
+	for (int x = 0; x < frame.width; ++x)
+		row[x] = Render_symbol(*text ? *text++ : ' ', fg_black, bg_white);
+	Screen_span s = {copy->data(), frame.width, frame.height};
+	return s;
+}
 
 int main(int argc, char *argv[])
 {
 
-	/* These should be even for convenience */
+	/*
+	 * These should be even for convenience. They follow the terminal, if
+	 * there is one; otherwise this is what we draw.
+	 */
 	int screen_x = 56;
 	int screen_y = 24;
-	Renderer renderer(screen_y, screen_x, 3.0, 100);
 
-	setup(&renderer);
-	input_setup();
+	/*
+	 * -w file saves the scene as a scene cache instead of showing it.
+	 * -p presents on a separate thread, -f sets the frame rate, -r picks
+	 * the raster format.
+	 * -S shows where frame time goes on the bottom row, -J file writes it
+	 * there once a second as JSON, and -T file records a Chrome trace.
+	 * -g WxH draws at that size rather than the terminal's.
+	 * -L socket draws for any number of viewers rather than this terminal,
+	 * and -C socket is one of them.
+	 * -W dir writes a made-up world to dir instead; given a world, only
+	 * the chunks around the camera are kept, in -M megabytes at most.
+	 */
+	const char *cache_path = 0;
+	int pipelined = 0;
+	double fps = 10.0;
+	int format = raster_double;
+	int overlay = 0;
+	const char *summary_path = 0;
+	const char *trace_path = 0;
+	int fixed_size = 0;
+	const char *serve_path = 0;
+	const char *client_path = 0;
+	const char *world_path = 0;
+	double budget_mb = 256.0;
+	int opt;
+	while ((opt = getopt(argc, argv, "w:pf:r:SJ:T:g:L:C:W:M:")) != -1) {
+		switch (opt) {
+		case 'w':
+			cache_path = optarg;
+			break;
+		case 'p':
+			pipelined = 1;
+			break;
+		case 'f':
+			fps = atof(optarg);
+			if (!(fps > 0.0))
+				usage(argv[0]);
+			break;
+		case 'r':
+			format = raster_format_from_name(optarg);
+			if (format < 0)
+				usage(argv[0]);
+			break;
+		case 'S':
+			overlay = 1;
+			break;
+		case 'J':
+			summary_path = optarg;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%dx%d", &screen_x, &screen_y) != 2 ||
+					screen_x < 2 || screen_y < 2 || (screen_x & 1) ||
+					(screen_y & 1)) {
+				fprintf(stderr, "bad size '%s' (want even WxH)\n", optarg);
+				usage(argv[0]);
+			}
+			fixed_size = 1;
+			break;
+		case 'L':
+			serve_path = optarg;
+			break;
+		case 'C':
+			client_path = optarg;
+			break;
+		case 'W':
+			world_path = optarg;
+			break;
+		case 'M':
+			budget_mb = atof(optarg);
+			if (!(budget_mb > 0.0))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (client_path)
+		return run_client(client_path, 1) < 0;
+	/* 64x64 chunks of 40 units, about 160 MB */
+	if (world_path)
+		return setup_world(world_path, 64) < 0;
+	/* The terminal's size doesn't matter to anyone else's */
+	if (!fixed_size && !serve_path)
+		terminal_size(1, &screen_y, &screen_x);
+	Renderer renderer(screen_y, screen_x, 3.0, 100, 1, (Raster_format) format);
+
+	/*
+	 * Show the mesh in the file given, if there is one, or the world; a
+	 * world starts off empty, and comes in as the camera goes round it
+	 */
+	std::unique_ptr<World_stream> world;
+	if (optind < argc && is_world(argv[optind])) {
+		world.reset(new World_stream());
+		std::string error;
+		if (world->open(argv[optind], (size_t) (budget_mb * 1048576),
+					&error) < 0) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	} else if (optind < argc) {
+		if (setup_mesh(&renderer, argv[optind]) < 0)
+			return 1;
+	} else {
+		setup(&renderer);
+	}
+	if (cache_path && world) {
+		fprintf(stderr, "%s: a world is made of scene caches already\n",
+				argv[optind]);
+		return 1;
+	}
+	if (cache_path) {
+		std::string error;
+		if (write_scene_cache(cache_path, &renderer, &error) < 0) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
 
-	double theta = 0.0;
 	double omega = 0.02;
-	double tetra_base_y = 60.0;
+	Vec3 tetra_base(0.0, 60.0, 0.0);
 	double turn_radius = 30.0;
-	while (1) {
-		//handle_input(&renderer);
-		renderer.camera_xangle -= omega;
-		theta -= omega;
-		renderer.camera_pos[1] = tetra_base_y - turn_radius * cos(theta);
-		renderer.camera_pos[0] = turn_radius * sin(theta);
-		
-		renderer.updated = true;
+	if (world) {
+		/* Round the middle of the town, about a chunk a second */
+		Aabb b = world->bounds();
+		tetra_base = Vec3(b.centre().x, b.centre().y, world_eye_height);
+		turn_radius = 0.7 * std::min(b.extent().x, b.extent().y);
+		omega = 4.0 / turn_radius;
+	}
+	Camera camera;
+	camera.pos = Vec3(tetra_base.x, tetra_base.y - turn_radius, tetra_base.z);
+
+	struct sigaction sa = {};
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+	if (serve_path)
+		return serve(&renderer, serve_path, fps, camera, tetra_base, omega,
+				world.get());
+
+	/* Only profiled when something is going to look at it */
+	std::unique_ptr<Profiler> profiler;
+	FILE *summary = 0;
+	if (overlay || summary_path || trace_path) {
+		profiler.reset(new Profiler());
+		renderer.set_profiler(profiler.get());
+	}
+	if (trace_path && profiler->open_trace(trace_path) < 0) {
+		perror(trace_path);
+		return 1;
+	}
+	if (summary_path && !(summary = fopen(summary_path, "w"))) {
+		perror(summary_path);
+		return 1;
+	}
+	std::vector<Render_symbol> overlaid;
+	char overlay_text[256];
+	/* When the next summary is due */
+	long summary_ns = now_ns() + 1000000000l;
+	unsigned long bytes_seen = 0, presenting_seen = 0;
+
+	Presenter presenter(1, screen_y, screen_x);
+	/* Goes before presenter does, as it uses it */
+	std::unique_ptr<Frame_pipeline> pipeline;
+	if (pipelined) {
+		pipeline.reset(new Frame_pipeline(&presenter, screen_y, screen_x, fps));
+		if (!pipeline->started()) {
+			fprintf(stderr, "can't start the presenter thread (%s); "
+					"presenting directly\n", strerror(errno));
+			pipeline.reset();
+		}
+	}
+	input_setup();
+
+	/* Picked up at the next tick */
+	sa.sa_handler = window_changed;
+	sigaction(SIGWINCH, &sa, 0);
+
+	/*
+	 * Frames are started by the event loop's clock; keys that came in
+	 * since the last one are applied to our copy of the camera, which is
+	 * then handed to the renderer in one go
+	 */
+	Event_loop loop(0, (long) (1e9 / fps));
+	int spinning = 1;
+	while (running) {
+		int ticks = loop.wait_frame();
+		if (!ticks)
+			continue;
+		/*
+		 * However many times the size changed while we waited, the
+		 * terminal is asked once
+		 */
+		if (resized && !fixed_size) {
+			resized = 0;
+			int y = screen_y, x = screen_x;
+			if (terminal_size(1, &y, &x) && (y != screen_y || x != screen_x)) {
+				screen_y = y;
+				screen_x = x;
+				renderer.resize(screen_y, screen_x);
+			}
+		}
+		int keys = apply_keys(&camera, loop.keys());
+		if (keys & keys_quit)
+			break;
+		/* Taking control stops the spinning; space starts it again */
+		if (keys & keys_moved)
+			spinning = 0;
+		if (keys & keys_toggle_spin)
+			spinning = !spinning;
+		if (spinning)
+			spin(&camera, tetra_base, omega);
+		renderer.set_camera(camera);
+		stream(world.get(), &renderer, camera);
+
+		if (profiler)
+			profiler->begin_frame();
+		/* Standing still, nothing gets drawn, let alone sent */
+		Screen_span frame = renderer.render();
+		size_t bytes = 0;
 		if (renderer.updated) {
-			/* used to be *** */
-			Render_symbol **a = renderer.render();
-				for (int i = 0; i < screen_y; ++i)
-				std::cout << "\n";
-				for (int i = 0; i < screen_y; ++i) {
-					for (int j = 0; j < screen_x; ++j) {
-/* used to be *a */
-						std::cout << (a)[i][j].get_string();
-					}
-					std::cout << "\n";
+			/* Pipelined, presenting is timed by the presenter thread */
+			Profile_scope p(pipeline ? 0 : profiler.get(), stage_present);
+			if (overlay) {
+				/*
+				 * The last frame's figures, as this one isn't done yet,
+				 * after chunks drawn/loaded and how many are yet to come
+				 */
+				size_t n = 0;
+				if (world) {
+					const World_stream::Stats &w = world->stats();
+					snprintf(overlay_text, sizeof(overlay_text),
+							"chunk %d/%d %.1fMB %d late | ", w.shown,
+							w.loaded, w.loaded_bytes / 1048576.0, w.missing);
+					n = strlen(overlay_text);
 				}
+				profiler->overlay(overlay_text + n, sizeof(overlay_text) - n);
+				frame = with_overlay(frame, overlay_text, &overlaid);
+			}
+			if (pipeline) {
+				/* The presenter thread takes it from here */
+				pipeline->submit(frame);
+				loop.set_period(pipeline->frame_period_ns());
+			} else {
+				/* Only the cells that changed get sent */
+				ssize_t n = presenter.present(frame);
+				if (n > 0)
+					bytes = n;
+			}
 		}
-		/* Limit framerate. Still doesn't play nicely on slow terminals */
-		//struct timespec u = {.tv_sec = 0, .tv_nsec = 1670000l};
-		struct timespec u = {.tv_sec = 0, .tv_nsec = 1000000000l / 10l};
-		nanosleep (&u, 0);
 
+		if (!profiler)
+			continue;
+		if (pipeline) {
+			/*
+			 * Whatever the presenter thread has sent since last time, and
+			 * how long it took
+			 */
+			Frame_pipeline::Stats s = pipeline->stats();
+			bytes = s.bytes - bytes_seen;
+			bytes_seen = s.bytes;
+			profiler->add(stage_present, s.presenting_ns - presenting_seen);
+			presenting_seen = s.presenting_ns;
+		}
+		profiler->end_frame(counters(renderer.stats, bytes));
+		/* Once a second, however many frames that was */
+		if (summary && now_ns() >= summary_ns) {
+			profiler->write_summary(summary);
+			summary_ns += 1000000000l;
+			/* Not a burst of them after a stall */
+			if (summary_ns <= now_ns())
+				summary_ns = now_ns() + 1000000000l;
+		}
 	}
 
-
+	input_restore();
+	if (summary)
+		fclose(summary);
 	return 0;
 }
@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mesh_import.hh"
+#include "workers.hh"
+
+enum Mesh_format {mesh_obj, mesh_stl_ascii, mesh_stl_binary};
+
+/* A piece of the file that one job parses */
+struct Import_chunk {
+	/* Text formats: bytes, always whole lines. Binary STL: triangles. */
+	size_t begin, end;
+	/* Counted by the first pass */
+	size_t n_vertices, n_triangles;
+	/* Where in the file's vertices and triangles this chunk's start */
+	size_t first_vertex, first_triangle;
+	/* Where and why parsing failed, if it did */
+	const char *error_at;
+	const char *error_what;
+};
+
+struct Import_job {
+	enum Mesh_format format;
+	const char *data;
+	size_t size;
+	std::vector<Import_chunk> chunks;
+	/* Totals over the whole file */
+	size_t n_vertices, n_triangles;
+	Render_object *obj;
+	/* How much obj had before, i.e. where the file's stuff goes */
+	size_t vertex_base, triangle_base;
+	Triangle_style style;
+};
+
+static const size_t stl_header = 84;
+static const size_t stl_record = 50;
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/* Skips spaces and tabs (but not newlines) */
+static const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		++p;
+	return p;
+}
+
+static const char *skip_token(const char *p, const char *end)
+{
+	while (p < end && !is_space(*p))
+		++p;
+	return p;
+}
+
+static const char *line_end(const char *p, const char *end)
+{
+	const char *eol = (const char *) memchr(p, '\n', end - p);
+	return eol ? eol : end;
+}
+
+/* Whether the token at p, which ends by end, is word */
+static int token_is(const char *p, const char *end, const char *word)
+{
+	size_t n = strlen(word);
+	return (size_t) (end - p) >= n && !memcmp(p, word, n)
+		&& (p + n == end || is_space(p[n]));
+}
+
+/*
+ * strtod() would do, except that it wants a terminated string (and the file
+ * needn't end in one), depends on the locale and is slow. This gets within an
+ * ulp or so, and is exact for anything with at most 15 significant digits and
+ * a small exponent, which is most of what gets written to mesh files.
+ * Returns the end of the number, or 0 if there isn't one at p.
+ */
+static const char *parse_double(const char *p, const char *end, double *out)
+{
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+		1e19, 1e20, 1e21, 1e22};
+	int neg = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	uint64_t mant = 0;
+	int digits = 0;
+	int exp10 = 0;
+	int any = 0;
+	/* Past 19 digits only the exponent changes */
+	for (; p < end && is_digit(*p); ++p, any = 1) {
+		if (digits < 19) {
+			mant = mant * 10 + (*p - '0');
+			digits += mant != 0;
+		} else {
+			++exp10;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && is_digit(*p); ++p, any = 1) {
+			if (digits < 19) {
+				mant = mant * 10 + (*p - '0');
+				digits += mant != 0;
+				--exp10;
+			}
+		}
+	}
+	if (!any)
+		return 0;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		int eneg = 0;
+		if (q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+		if (q < end && is_digit(*q)) {
+			int e = 0;
+			for (; q < end && is_digit(*q); ++q) {
+				if (e < 100000)
+					e = e * 10 + (*q - '0');
+			}
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	double v = (double) mant;
+	if (mant < (1ull << 53) && exp10 >= -22 && exp10 <= 22)
+		v = exp10 < 0 ? v / pow10[-exp10] : v * pow10[exp10];
+	else if (mant)
+		v *= pow(10.0, exp10);
+	*out = neg ? -v : v;
+	return p;
+}
+
+static const char *parse_long(const char *p, const char *end, long *out)
+{
+	int neg = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	if (p == end || !is_digit(*p))
+		return 0;
+	long v = 0;
+	for (; p < end && is_digit(*p); ++p) {
+		if (v < LONG_MAX / 10 - 10)
+			v = v * 10 + (*p - '0');
+	}
+	*out = neg ? -v : v;
+	return p;
+}
+
+/*
+ * First pass over a chunk of text: just counts. This has to agree exactly
+ * with the second pass about what a vertex and a triangle are.
+ */
+static void count_chunk(void *ctx, int i)
+{
+	Import_job *job = (Import_job *) ctx;
+	Import_chunk *c = &job->chunks[i];
+	const char *p = job->data + c->begin;
+	const char *end = job->data + c->end;
+	size_t nv = 0, nt = 0;
+	while (p < end) {
+		const char *eol = line_end(p, end);
+		const char *q = skip_space(p, eol);
+		if (job->format == mesh_obj) {
+			/* Comments can follow faces */
+			const char *hash = (const char *) memchr(q, '#', eol - q);
+			const char *stop = hash ? hash : eol;
+			if (token_is(q, stop, "v")) {
+				++nv;
+			} else if (token_is(q, stop, "f")) {
+				size_t k = 0;
+				for (q = skip_space(q + 1, stop); q < stop;
+						q = skip_space(skip_token(q, stop), stop))
+					++k;
+				if (k >= 3)
+					nt += k - 2;
+			}
+		} else if (token_is(q, eol, "vertex")) {
+			++nv;
+		}
+		p = eol < end ? eol + 1 : end;
+	}
+	c->n_vertices = nv;
+	c->n_triangles = nt;
+}
+
+static void put_vertex(Import_job *job, size_t v, double x, double y, double z)
+{
+	Vertex_buffer &vb = job->obj->vertices;
+	vb.xs[job->vertex_base + v] = x;
+	vb.ys[job->vertex_base + v] = y;
+	vb.zs[job->vertex_base + v] = z;
+}
+
+static void put_triangle(Import_job *job, size_t t, size_t a, size_t b,
+		size_t c)
+{
+	unsigned *idx = &job->obj->indices[3 * (job->triangle_base + t)];
+	idx[0] = (unsigned) (job->vertex_base + a);
+	idx[1] = (unsigned) (job->vertex_base + b);
+	idx[2] = (unsigned) (job->vertex_base + c);
+	job->obj->styles[job->triangle_base + t] = job->style;
+}
+
+/* Second pass over a chunk of OBJ */
+static void parse_obj_chunk(Import_job *job, Import_chunk *c)
+{
+	const char *p = job->data + c->begin;
+	const char *end = job->data + c->end;
+	size_t v = c->first_vertex;
+	size_t t = c->first_triangle;
+	while (p < end) {
+		const char *eol = line_end(p, end);
+		const char *q = skip_space(p, eol);
+		const char *hash = (const char *) memchr(q, '#', eol - q);
+		const char *stop = hash ? hash : eol;
+		if (token_is(q, stop, "v")) {
+			double xyz[3];
+			q = q + 1;
+			for (int i = 0; i < 3; ++i) {
+				q = parse_double(skip_space(q, stop), stop, &xyz[i]);
+				if (!q || (q < stop && !is_space(*q))) {
+					c->error_at = p;
+					c->error_what = "bad vertex";
+					return;
+				}
+			}
+			put_vertex(job, v++, xyz[0], xyz[1], xyz[2]);
+		} else if (token_is(q, stop, "f")) {
+			size_t first = 0, prev = 0;
+			int k = 0;
+			for (q = skip_space(q + 1, stop); q < stop;
+					q = skip_space(skip_token(q, stop), stop), ++k) {
+				/* Only the position index of v/vt/vn matters */
+				long n;
+				const char *r = parse_long(q, stop, &n);
+				if (!r || (r < stop && !is_space(*r) && *r != '/')) {
+					c->error_at = p;
+					c->error_what = "bad face";
+					return;
+				}
+				/* Negative indices count back from the latest vertex */
+				long vi = n > 0 ? n - 1 : (long) v + n;
+				if (n == 0 || vi < 0 || (size_t) vi >= job->n_vertices) {
+					c->error_at = p;
+					c->error_what = "face refers to a vertex that isn't there";
+					return;
+				}
+				if (k == 0)
+					first = vi;
+				else if (k >= 2)
+					put_triangle(job, t++, first, prev, vi);
+				prev = vi;
+			}
+		}
+		p = eol < end ? eol + 1 : end;
+	}
+}
+
+/* Second pass over a chunk of ASCII STL: each vertex line is a new vertex */
+static void parse_stl_ascii_chunk(Import_job *job, Import_chunk *c)
+{
+	const char *p = job->data + c->begin;
+	const char *end = job->data + c->end;
+	size_t v = c->first_vertex;
+	while (p < end) {
+		const char *eol = line_end(p, end);
+		const char *q = skip_space(p, eol);
+		if (token_is(q, eol, "vertex")) {
+			double xyz[3];
+			q += 6;
+			for (int i = 0; i < 3; ++i) {
+				q = parse_double(skip_space(q, eol), eol, &xyz[i]);
+				if (!q || (q < eol && !is_space(*q))) {
+					c->error_at = p;
+					c->error_what = "bad vertex";
+					return;
+				}
+			}
+			put_vertex(job, v, xyz[0], xyz[1], xyz[2]);
+			if (v % 3 == 2)
+				put_triangle(job, v / 3, v - 2, v - 1, v);
+			++v;
+		}
+		p = eol < end ? eol + 1 : end;
+	}
+}
+
+/*
+ * Binary STL: a triangle is a normal and three vertices as little-endian
+ * floats (which is what we are), and two bytes nobody uses
+ */
+static void parse_stl_binary_chunk(Import_job *job, Import_chunk *c)
+{
+	for (size_t t = c->begin; t < c->end; ++t) {
+		const char *rec = job->data + stl_header + t * stl_record;
+		float f[9];
+		memcpy(f, rec + 12, sizeof(f));
+		for (int i = 0; i < 3; ++i)
+			put_vertex(job, 3 * t + i, f[3 * i], f[3 * i + 1], f[3 * i + 2]);
+		put_triangle(job, t, 3 * t, 3 * t + 1, 3 * t + 2);
+	}
+}
+
+static void parse_chunk(void *ctx, int i)
+{
+	Import_job *job = (Import_job *) ctx;
+	Import_chunk *c = &job->chunks[i];
+	if (job->format == mesh_obj)
+		parse_obj_chunk(job, c);
+	else if (job->format == mesh_stl_ascii)
+		parse_stl_ascii_chunk(job, c);
+	else
+		parse_stl_binary_chunk(job, c);
+}
+
+static enum Mesh_format detect_format(const char *path, const char *data,
+		size_t size)
+{
+	const char *dot = strrchr(path, '.');
+	int obj = dot && !strcasecmp(dot, ".obj");
+	int stl = dot && !strcasecmp(dot, ".stl");
+	if (obj)
+		return mesh_obj;
+	/*
+	 * Binary STL is allowed to start with "solid" too, so the size is the
+	 * better giveaway
+	 */
+	if (size >= stl_header) {
+		uint32_t n;
+		memcpy(&n, data + 80, sizeof(n));
+		if (stl_header + (uint64_t) n * stl_record == size)
+			return mesh_stl_binary;
+	}
+	int solid = size >= 5 && !memcmp(data, "solid", 5);
+	if (stl)
+		return solid ? mesh_stl_ascii : mesh_stl_binary;
+	return solid ? mesh_stl_ascii : mesh_obj;
+}
+
+/* Splits the text into about n chunks of whole lines */
+static void split_lines(Import_job *job, int n)
+{
+	size_t begin = 0;
+	for (int i = 1; i <= n && begin < job->size; ++i) {
+		size_t end = job->size * i / n;
+		if (end < begin)
+			end = begin;
+		if (i < n) {
+			const char *eol = line_end(job->data + end, job->data + job->size);
+			end = eol - job->data;
+			if (end < job->size)
+				++end;
+		}
+		Import_chunk c = {begin, end, 0, 0, 0, 0, 0, 0};
+		if (end > begin)
+			job->chunks.push_back(c);
+		begin = end;
+	}
+}
+
+static int fail(std::string *error, const char *path, const char *what)
+{
+	if (error)
+		*error = std::string(path) + ": " + what;
+	return -1;
+}
+
+int import_mesh(const char *path, Render_object *obj, const Triangle_style &style,
+		int n_threads, std::string *error)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return fail(error, path, strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int e = errno;
+		close(fd);
+		return fail(error, path, strerror(e));
+	}
+	size_t size = st.st_size;
+	/* Nothing to map, and nothing to add */
+	if (!size) {
+		close(fd);
+		return 0;
+	}
+	void *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int e = errno;
+	/* The mapping keeps the file open */
+	close(fd);
+	if (map == MAP_FAILED)
+		return fail(error, path, strerror(e));
+	madvise(map, size, MADV_WILLNEED);
+
+	if (n_threads <= 0)
+		n_threads = (int) std::thread::hardware_concurrency();
+	if (n_threads <= 0)
+		n_threads = 1;
+
+	Import_job job;
+	job.data = (const char *) map;
+	job.size = size;
+	job.format = detect_format(path, job.data, size);
+	job.obj = obj;
+	job.vertex_base = obj->vertices.size();
+	job.triangle_base = obj->n_triangles();
+	job.style = style;
+
+	/*
+	 * About a megabyte a chunk, but at least a few per thread so that they
+	 * even out
+	 */
+	int n_chunks = (int) std::min<size_t>(size >> 20, 1024) + 1;
+	if (n_chunks < 4 * n_threads && size > (64u << 10))
+		n_chunks = 4 * n_threads;
+	Worker_pool pool(n_threads - 1);
+
+	const char *problem = 0;
+	if (job.format == mesh_stl_binary) {
+		uint32_t n = 0;
+		if (size >= stl_header)
+			memcpy(&n, job.data + 80, sizeof(n));
+		if (size < stl_header + (uint64_t) n * stl_record) {
+			problem = "truncated binary STL";
+		} else {
+			for (int i = 0; i < n_chunks; ++i) {
+				Import_chunk c = {(size_t) n * i / n_chunks,
+					(size_t) n * (i + 1) / n_chunks, 0, 0, 0, 0, 0, 0};
+				job.chunks.push_back(c);
+			}
+			job.n_triangles = n;
+			job.n_vertices = 3 * (size_t) n;
+		}
+	} else {
+		split_lines(&job, n_chunks);
+		pool.run(count_chunk, &job, (int) job.chunks.size());
+		job.n_vertices = job.n_triangles = 0;
+		for (size_t i = 0; i < job.chunks.size(); ++i) {
+			job.chunks[i].first_vertex = job.n_vertices;
+			job.chunks[i].first_triangle = job.n_triangles;
+			job.n_vertices += job.chunks[i].n_vertices;
+			job.n_triangles += job.chunks[i].n_triangles;
+		}
+		if (job.format == mesh_stl_ascii) {
+			if (job.n_vertices % 3)
+				problem = "ASCII STL with a facet that isn't a triangle";
+			job.n_triangles = job.n_vertices / 3;
+		}
+	}
+	if (!problem && job.vertex_base + job.n_vertices > UINT_MAX)
+		problem = "too many vertices";
+
+	if (!problem) {
+		/* Everything is sized once, then filled in in place */
+		Vertex_buffer &vb = obj->vertices;
+		vb.xs.resize(job.vertex_base + job.n_vertices);
+		vb.ys.resize(job.vertex_base + job.n_vertices);
+		vb.zs.resize(job.vertex_base + job.n_vertices);
+		obj->indices.resize(3 * (job.triangle_base + job.n_triangles));
+		obj->styles.resize(job.triangle_base + job.n_triangles);
+		pool.run(parse_chunk, &job, (int) job.chunks.size());
+
+		/* Report the first problem in the file, not the first one found */
+		for (size_t i = 0; i < job.chunks.size() && !problem; ++i) {
+			if (job.chunks[i].error_at) {
+				problem = job.chunks[i].error_what;
+				const char *at = job.chunks[i].error_at;
+				const char *line = at;
+				size_t line_len = line_end(at, job.data + size) - at;
+				if (line_len > 60)
+					line_len = 60;
+				if (error) {
+					fail(error, path, problem);
+					*error += " at byte " + std::to_string(at - job.data)
+						+ ": " + std::string(line, line_len);
+				}
+			}
+		}
+		if (problem) {
+			vb.xs.resize(job.vertex_base);
+			vb.ys.resize(job.vertex_base);
+			vb.zs.resize(job.vertex_base);
+			obj->indices.resize(3 * job.triangle_base);
+			obj->styles.resize(job.triangle_base);
+			munmap(map, size);
+			return -1;
+		}
+	}
+	munmap(map, size);
+	if (problem)
+		return fail(error, path, problem);
+	obj->bounds_dirty = 1;
+	return 0;
+}
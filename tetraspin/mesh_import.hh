@@ -0,0 +1,26 @@
+#ifndef MESH_IMPORT_H_I
+#define MESH_IMPORT_H_I
+
+#include <string>
+
+#include "render.hh"
+
+/*
+ * Loads triangles from a mesh file into obj, after whatever it already has.
+ * Understands Wavefront OBJ (v and f lines only; polygons are split into
+ * fans, everything else is ignored) and STL, binary or ASCII. Which one is
+ * decided by the extension, or failing that by looking at the contents.
+ *
+ * The file is mapped rather than read, and parsed in two passes over chunks
+ * of it spread over n_threads threads (0 for one per core): the first counts
+ * vertices and triangles so the arrays can be sized exactly once, and the
+ * second parses every chunk straight into its part of them. STL has no
+ * shared vertices, so each of its triangles gets three of its own.
+ *
+ * Every triangle gets style. Returns 0 on success, or -1 with obj as it was
+ * and, if error isn't 0, a description of what went wrong in *error.
+ */
+int import_mesh(const char *path, Render_object *obj, const Triangle_style &style,
+		int n_threads = 0, std::string *error = 0);
+
+#endif
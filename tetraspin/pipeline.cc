@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipeline.hh"
+
+static long ns_between(const struct timespec &a, const struct timespec &b)
+{
+	return (b.tv_sec - a.tv_sec) * 1000000000l + (b.tv_nsec - a.tv_nsec);
+}
+
+/* Wakes up the presenter. Can't really fail, short of an overflow. */
+static void wake(int fd)
+{
+	uint64_t one = 1;
+	while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+}
+
+Frame_pipeline::Frame_pipeline(Presenter *presenter, int height, int width,
+		double target_fps)
+	: presenter(presenter), back(0), front(1), ready(2), quit(0),
+	n_submitted(0), n_presented(0), n_dropped(0), n_bytes(0), present_ns(0),
+	n_presenting_ns(0)
+{
+	for (int i = 0; i < 3; ++i) {
+		buffers[i].resize((size_t) width * height);
+		widths[i] = width;
+		heights[i] = height;
+	}
+	this->target_ns = target_fps > 0.0 ? (long) (1e9 / target_fps) : 0;
+	this->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (this->wake_fd < 0)
+		return;
+
+	/* Signals are for the main thread; the presenter shouldn't get them */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	this->thread = std::thread(&Frame_pipeline::presenter_main, this);
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+Frame_pipeline::~Frame_pipeline()
+{
+	if (!this->started())
+		return;
+	this->quit = 1;
+	wake(this->wake_fd);
+	this->thread.join();
+	close(this->wake_fd);
+}
+
+Screen_span Frame_pipeline::span(int i) const
+{
+	Screen_span s = {this->buffers[i].data(), this->widths[i],
+		this->heights[i]};
+	return s;
+}
+
+void Frame_pipeline::submit(Screen_span frame)
+{
+	/* The presenter notices a change of size itself */
+	int b = this->back;
+	resize_reserved(&this->buffers[b], (size_t) frame.width * frame.height);
+	this->widths[b] = frame.width;
+	this->heights[b] = frame.height;
+	memcpy(this->buffers[b].data(), frame.data,
+			(size_t) frame.width * frame.height * sizeof(Render_symbol));
+
+	/* Publish it, and take whichever buffer was published before */
+	unsigned old = this->ready.exchange(this->back | fresh);
+	if (old & fresh)
+		++this->n_dropped;
+	this->back = old & ~fresh;
+	++this->n_submitted;
+	wake(this->wake_fd);
+}
+
+void Frame_pipeline::presenter_main()
+{
+	while (1) {
+		uint64_t n;
+		if (read(this->wake_fd, &n, sizeof(n)) < 0 && errno != EINTR)
+			break;
+		if (this->quit)
+			break;
+		if (!(this->ready.load() & fresh))
+			continue;
+		/* Swap our old buffer for the newest frame */
+		unsigned r = this->ready.exchange(this->front);
+		this->front = r & ~fresh;
+
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		ssize_t sent = this->presenter->present(this->span(this->front));
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (sent > 0)
+			this->n_bytes += sent;
+		/* Smoothed, so one slow write doesn't halve the frame rate */
+		long took = ns_between(t0, t1);
+		this->n_presenting_ns += took;
+		long was = this->present_ns.load();
+		this->present_ns = was ? was + (took - was) / 8 : took;
+		++this->n_presented;
+	}
+}
+
+long Frame_pipeline::frame_period_ns() const
+{
+	long period = this->target_ns;
+	/*
+	 * No point rendering faster than frames can be presented: go a little
+	 * slower than the presenter, so that it keeps up and the frame it shows
+	 * is fresh
+	 */
+	long p = this->present_ns.load();
+	if (p + p / 8 > period)
+		period = p + p / 8;
+	return period;
+}
+
+Frame_pipeline::Stats Frame_pipeline::stats() const
+{
+	Stats s;
+	s.submitted = this->n_submitted.load();
+	s.presented = this->n_presented.load();
+	s.dropped = this->n_dropped.load();
+	s.bytes = this->n_bytes.load();
+	s.present_ns = this->present_ns.load();
+	s.presenting_ns = this->n_presenting_ns.load();
+	return s;
+}
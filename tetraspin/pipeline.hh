@@ -0,0 +1,92 @@
+#ifndef PIPELINE_H_I
+#define PIPELINE_H_I
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.hh"
+#include "present.hh"
+
+/*
+ * Presents frames on a thread of its own, so that the next frame can be
+ * rendered while the terminal is still swallowing the last one.
+ *
+ * Frames are handed over through three buffers: the one being filled, the
+ * one being presented, and the latest finished frame, which the two sides
+ * swap their own for with an atomic exchange. Neither side ever waits for
+ * the other: if a new frame is finished before the presenter has taken the
+ * last one, the last one is dropped rather than queued, so what gets shown is
+ * always the newest frame there is.
+ *
+ * frame_period_ns() is what the event loop's frame timer should be set to:
+ * the target rate, slowed down to what the presenter is actually managing
+ * when the terminal can't keep up, so that frames aren't rendered only to be
+ * dropped.
+ */
+class Frame_pipeline {
+	public:
+		/*
+		 * Frames go to presenter. Room is made for height x width cells to
+		 * start with; bigger frames make more. See started().
+		 */
+		Frame_pipeline(Presenter *presenter, int height, int width,
+				double target_fps);
+		/*
+		 * Whether the presenter thread is going. If not (errno says why),
+		 * nothing else is to be called; present directly instead.
+		 */
+		int started() const { return wake_fd >= 0; }
+		/* Finishes presenting whatever it was presenting, and stops */
+		~Frame_pipeline();
+		/* Hands over a copy of frame. Never blocks. */
+		void submit(Screen_span frame);
+		/*
+		 * How long frames should take: the target, or longer if the
+		 * presenter can't keep up with that
+		 */
+		long frame_period_ns() const;
+
+		struct Stats {
+			unsigned long submitted, presented, dropped;
+			/* Sent to the terminal, all told */
+			unsigned long bytes;
+			/* Recent time taken to present a frame */
+			long present_ns;
+			/* Time spent presenting, all told */
+			unsigned long presenting_ns;
+		};
+		Stats stats() const;
+
+	private:
+		Frame_pipeline(const Frame_pipeline &);
+		Frame_pipeline &operator=(const Frame_pipeline &);
+
+		/* Set in ready when the presenter hasn't taken that frame yet */
+		static const unsigned fresh = 4;
+
+		void presenter_main();
+		Screen_span span(int i) const;
+
+		Presenter *presenter;
+		/* Each has the size of the frame last copied into it */
+		std::vector<Render_symbol> buffers[3];
+		int widths[3], heights[3];
+		/* The render thread's buffer, and the presenter's */
+		int back, front;
+		/* Which buffer has the latest finished frame, | fresh */
+		std::atomic<unsigned> ready;
+		/* eventfd the presenter sleeps on */
+		int wake_fd;
+		std::atomic<int> quit;
+
+		std::atomic<unsigned long> n_submitted, n_presented, n_dropped, n_bytes;
+		std::atomic<long> present_ns;
+		std::atomic<unsigned long> n_presenting_ns;
+
+		long target_ns;
+
+		std::thread thread;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "present.hh"
+
+/*
+ * Gaps of unchanged cells no longer than this get rewritten rather than
+ * skipped: a cursor movement costs at least six bytes.
+ */
+static const int max_rewrite_gap = 4;
+
+/* Writes n in decimal at p, returning the position after it */
+static char *put_uint(char *p, unsigned int n)
+{
+	char tmp[10];
+	int len = 0;
+	do {
+		tmp[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (len)
+		*p++ = tmp[--len];
+	return p;
+}
+
+static char *put_str(char *p, const char *s)
+{
+	size_t len = strlen(s);
+	memcpy(p, s, len);
+	return p + len;
+}
+
+Presenter::Presenter(int fd, int height, int width)
+	: fd(fd), width(0), height(0), have_previous(0)
+{
+	this->resize(height, width);
+	cur_y = cur_x = -1;
+	cur_colours = -1;
+	sgr = sgr_table();
+}
+
+void Presenter::resize(int height, int width)
+{
+	this->width = width;
+	this->height = height;
+	resize_reserved(&previous, (size_t) width * height);
+	/*
+	 * Worst case: every cell needs a colour change and its own cursor
+	 * movement, plus the frame header and trailer
+	 */
+	resize_reserved(&out,
+			(size_t) width * height * (max_sgr_len + max_cup_len + 1) + 64);
+	pos = out.data();
+	have_previous = 0;
+}
+
+Presenter::~Presenter()
+{
+	if (this->fd < 0)
+		return;
+	/* Reset colours, put the cursor below the frame and show it again */
+	char buf[32];
+	char *p = buf;
+	p = put_str(p, "\x1b[0m\x1b[");
+	p = put_uint(p, height + 1);
+	p = put_str(p, ";1H\x1b[?25h");
+	if (write(this->fd, buf, p - buf) < 0)
+		return;
+}
+
+void Presenter::emit_cup(int y, int x)
+{
+	/* CUP is 1-based */
+	pos = put_str(pos, "\x1b[");
+	pos = put_uint(pos, y + 1);
+	*pos++ = ';';
+	pos = put_uint(pos, x + 1);
+	*pos++ = 'H';
+	cur_y = y;
+	cur_x = x;
+}
+
+void Presenter::emit_sgr(unsigned colours)
+{
+	/* Copy the whole padded sequence, then only keep what it needs */
+	const Sgr_sequence &s = sgr[colours];
+	memcpy(pos, s.bytes, sizeof(s.bytes));
+	pos += s.len;
+	cur_colours = colours;
+}
+
+void Presenter::emit_cell(const Render_symbol &s)
+{
+	if ((int) s.colours() != cur_colours)
+		emit_sgr(s.colours());
+	*pos++ = s.get_char();
+	/*
+	 * Writing the last column leaves the cursor in a state that differs
+	 * between terminals, so don't rely on it
+	 */
+	if (++cur_x >= width)
+		cur_y = cur_x = -1;
+}
+
+size_t Presenter::encode(Screen_span frame)
+{
+	if (frame.width != width || frame.height != height)
+		this->resize(frame.height, frame.width);
+	pos = out.data();
+	cur_y = cur_x = -1;
+	/* The previous frame ended with a reset */
+	cur_colours = 0;
+
+	int full = !have_previous;
+	if (full) {
+		/* Hide cursor, clear screen */
+		pos = put_str(pos, "\x1b[?25l\x1b[H\x1b[2J");
+	}
+
+	Render_symbol *prev = previous.data();
+	for (int y = 0; y < height; ++y) {
+		const Render_symbol *row = frame[y];
+		Render_symbol *prev_row = prev + (size_t) y * width;
+		/* Cells are plain words, so unchanged rows can be skipped whole */
+		if (!full && !memcmp(row, prev_row, width * sizeof(Render_symbol)))
+			continue;
+		int x = 0;
+		while (x < width) {
+			if (!full && row[x] == prev_row[x]) {
+				++x;
+				continue;
+			}
+			/* Start of a run of changes */
+			if (cur_y != y || cur_x != x)
+				emit_cup(y, x);
+			while (x < width) {
+				if (full || row[x] != prev_row[x]) {
+					emit_cell(row[x]);
+					prev_row[x] = row[x];
+					++x;
+					continue;
+				}
+				/* Carry on through short unchanged gaps */
+				int gap = 1;
+				while (x + gap < width && gap <= max_rewrite_gap &&
+						row[x + gap] == prev_row[x + gap])
+					++gap;
+				if (x + gap >= width || gap > max_rewrite_gap) {
+					x += gap;
+					break;
+				}
+				for (int i = 0; i < gap; ++i)
+					emit_cell(row[x++]);
+			}
+		}
+	}
+
+	if (cur_colours)
+		pos = put_str(pos, "\x1b[0m");
+	have_previous = 1;
+	return pos - out.data();
+}
+
+ssize_t Presenter::present(Screen_span frame)
+{
+	size_t len = this->encode(frame);
+	if (this->fd < 0)
+		return len;
+	size_t done = 0;
+	/* One write; only loops if the terminal takes a partial one */
+	while (done < len) {
+		ssize_t n = write(this->fd, out.data() + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* Non-blocking and full: sleep until there's room again */
+			struct pollfd p = {this->fd, POLLOUT, 0};
+			if (poll(&p, 1, -1) >= 0 || errno == EINTR)
+				continue;
+		}
+		if (n < 0) {
+			have_previous = 0;
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
@@ -0,0 +1,74 @@
+#ifndef PRESENT_H_I
+#define PRESENT_H_I
+
+#include <sys/types.h>
+#include <vector>
+
+#include "framebuffer.hh"
+
+/*
+ * Gets frames onto the terminal. Remembers what it sent last time and only
+ * sends the cells that have changed since, jumping the cursor over the rest
+ * and only changing colour when the colour actually changes. Each frame
+ * goes out as a single write from a buffer allocated up front, which matters
+ * a lot more than anything else on slow terminals and ssh links.
+ */
+class Presenter {
+	public:
+		/*
+		 * Frames of height x width cells get written to file descriptor
+		 * fd. With fd < 0 (encode_only), nothing is ever written anywhere:
+		 * frames are only encoded, for whoever takes them from buffer().
+		 */
+		Presenter(int fd, int height, int width);
+		static const int encode_only = -1;
+		/* Puts the cursor and colours back the way they were, if writing */
+		~Presenter();
+		/*
+		 * Sends frame to the terminal. Returns the number of bytes written,
+		 * or -1 if writing failed (in which case the next frame is sent in
+		 * full). A frame of a different size from the last (the terminal
+		 * has been resized) is sent in full too, on a cleared screen.
+		 * Encoding only, it's the same as encode().
+		 */
+		ssize_t present(Screen_span frame);
+		/*
+		 * Encodes frame into the output buffer without writing it, as if it
+		 * were presented. Returns the number of bytes in the buffer.
+		 */
+		size_t encode(Screen_span frame);
+		const char *buffer() const { return out.data(); }
+		/* Forget what is on the terminal; the next frame is sent in full */
+		void invalidate() { have_previous = 0; }
+
+	private:
+		/* Takes frames of height x width from now on */
+		void resize(int height, int width);
+
+		/*
+		 * Longest escape sequences encode() can produce, in bytes. Colour
+		 * changes are copied a whole Sgr_sequence at a time, so that is the
+		 * most room one can take.
+		 */
+		static const size_t max_sgr_len = sizeof(Sgr_sequence::bytes);
+		static const size_t max_cup_len = 16;
+
+		void emit_cup(int y, int x);
+		void emit_sgr(unsigned colours);
+		void emit_cell(const Render_symbol &s);
+
+		int fd;
+		int width, height;
+		/* What the terminal is showing, as far as we know */
+		std::vector<Render_symbol> previous;
+		int have_previous;
+		/* Preallocated to hold the worst possible frame */
+		std::vector<char> out;
+		char *pos;
+		/* Terminal state while encoding; -1 means unknown */
+		int cur_y, cur_x;
+		int cur_colours;
+		const Sgr_sequence *sgr;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "profile.hh"
+
+const char *const profile_stage_names[n_profile_stages] = {
+	"other", "clear", "project", "cull", "raster", "present"
+};
+
+Profiler::Profiler()
+	: stage(stage_other), depth(0), frame_no(0), sum_frames(0), max_ns(0),
+	trace(0)
+{
+	this->last_ns = this->frame_start_ns = this->scope_start_ns = now_ns();
+	memset(this->stage_ns, 0, sizeof(this->stage_ns));
+	memset(&this->last_frame, 0, sizeof(this->last_frame));
+	memset(&this->sum, 0, sizeof(this->sum));
+	this->trace_start_ns = this->last_ns;
+}
+
+Profiler::~Profiler()
+{
+	if (this->trace) {
+		fputs("\n]\n", this->trace);
+		fclose(this->trace);
+	}
+}
+
+int Profiler::open_trace(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	if (this->trace) {
+		fputs("\n]\n", this->trace);
+		fclose(this->trace);
+	}
+	this->trace = f;
+	this->trace_start_ns = now_ns();
+	/* The array format; the closing bracket is optional, should we crash */
+	fputs("[{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+			"\"args\": {\"name\": \"tetraspin\"}}", f);
+	return 0;
+}
+
+void Profiler::trace_span(const char *name, long start_ns, long end_ns)
+{
+	fprintf(this->trace, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+			"\"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}", name,
+			(start_ns - this->trace_start_ns) / 1e3,
+			(end_ns - start_ns) / 1e3);
+}
+
+void Profiler::begin_frame()
+{
+	long t = now_ns();
+	memset(this->stage_ns, 0, sizeof(this->stage_ns));
+	this->stage = stage_other;
+	this->depth = 0;
+	this->last_ns = this->frame_start_ns = t;
+}
+
+void Profiler::end_frame(const Profile_counters &c)
+{
+	long t = now_ns();
+	this->stage_ns[this->stage] += t - this->last_ns;
+	this->last_ns = t;
+
+	Frame &f = this->last_frame;
+	f.total_ns = t - this->frame_start_ns;
+	memcpy(f.stage_ns, this->stage_ns, sizeof(f.stage_ns));
+	f.counters = c;
+	++this->frame_no;
+
+	++this->sum_frames;
+	this->sum.total_ns += f.total_ns;
+	for (int i = 0; i < n_profile_stages; ++i)
+		this->sum.stage_ns[i] += f.stage_ns[i];
+	Profile_counters &s = this->sum.counters;
+	s.triangles_submitted += c.triangles_submitted;
+	s.triangles_culled += c.triangles_culled;
+	s.triangles_rasterized += c.triangles_rasterized;
+	s.cells_tested += c.cells_tested;
+	s.depth_rejects += c.depth_rejects;
+	s.bytes_written += c.bytes_written;
+	if (f.total_ns > this->max_ns)
+		this->max_ns = f.total_ns;
+
+	if (!this->trace)
+		return;
+	char name[32];
+	snprintf(name, sizeof(name), "frame %lu", this->frame_no);
+	this->trace_span(name, this->frame_start_ns, t);
+	double ts = (t - this->trace_start_ns) / 1e3;
+	fprintf(this->trace, ",\n{\"name\": \"stage us\", \"ph\": \"C\", "
+			"\"pid\": 1, \"ts\": %.3f, \"args\": {", ts);
+	for (int i = 0; i < n_profile_stages; ++i)
+		fprintf(this->trace, "%s\"%s\": %.3f", i ? ", " : "",
+				profile_stage_names[i], f.stage_ns[i] / 1e3);
+	fprintf(this->trace, "}},\n{\"name\": \"triangles\", \"ph\": \"C\", "
+			"\"pid\": 1, \"ts\": %.3f, \"args\": {\"submitted\": %zu, "
+			"\"culled\": %zu, \"rasterized\": %zu}}", ts,
+			c.triangles_submitted, c.triangles_culled,
+			c.triangles_rasterized);
+	fprintf(this->trace, ",\n{\"name\": \"cells\", \"ph\": \"C\", "
+			"\"pid\": 1, \"ts\": %.3f, \"args\": {\"tested\": %zu, "
+			"\"depth_rejects\": %zu}}", ts, c.cells_tested, c.depth_rejects);
+	fprintf(this->trace, ",\n{\"name\": \"bytes written\", \"ph\": \"C\", "
+			"\"pid\": 1, \"ts\": %.3f, \"args\": {\"bytes\": %zu}}", ts,
+			c.bytes_written);
+}
+
+void Profiler::overlay(char *buf, size_t len) const
+{
+	const Frame &f = this->last_frame;
+	const Profile_counters &c = f.counters;
+	int n = snprintf(buf, len, "%.2fms:", f.total_ns / 1e6);
+	/* Short names so it fits on main's screen */
+	static const char *const abbrev[n_profile_stages] = {
+		"oth", "clr", "prj", "cul", "ras", "pre"
+	};
+	for (int i = 1; i < n_profile_stages && n >= 0 && (size_t) n < len; ++i)
+		n += snprintf(buf + n, len - n, " %s %.2f", abbrev[i],
+				f.stage_ns[i] / 1e6);
+	if (n >= 0 && (size_t) n < len)
+		snprintf(buf + n, len - n, " | tri %zu/%zu/%zu cell %zu/%zu %zuB",
+				c.triangles_submitted, c.triangles_culled,
+				c.triangles_rasterized, c.cells_tested, c.depth_rejects,
+				c.bytes_written);
+}
+
+void Profiler::write_summary(FILE *out)
+{
+	double n = this->sum_frames ? this->sum_frames : 1;
+	const Profile_counters &c = this->sum.counters;
+	fprintf(out, "{\"frames\": %lu, \"ms_mean\": %.3f, \"ms_max\": %.3f, "
+			"\"stages_ms\": {", this->sum_frames, this->sum.total_ns / n / 1e6,
+			this->max_ns / 1e6);
+	for (int i = 0; i < n_profile_stages; ++i)
+		fprintf(out, "%s\"%s\": %.3f", i ? ", " : "", profile_stage_names[i],
+				this->sum.stage_ns[i] / n / 1e6);
+	fprintf(out, "}, \"per_frame\": {\"triangles_submitted\": %.1f, "
+			"\"triangles_culled\": %.1f, \"triangles_rasterized\": %.1f, "
+			"\"cells_tested\": %.1f, \"depth_rejects\": %.1f, "
+			"\"bytes_written\": %.1f}}\n", c.triangles_submitted / n,
+			c.triangles_culled / n, c.triangles_rasterized / n,
+			c.cells_tested / n, c.depth_rejects / n, c.bytes_written / n);
+	fflush(out);
+
+	this->sum_frames = 0;
+	memset(&this->sum, 0, sizeof(this->sum));
+	this->max_ns = 0;
+}
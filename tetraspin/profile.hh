@@ -0,0 +1,170 @@
+#ifndef PROFILE_H_I
+#define PROFILE_H_I
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Where frame time goes. A Profiler keeps track of which stage of the frame
+ * is under way (Profile_scope switches it, and back again at the end of
+ * the scope), and adds the time since the last switch to the stage that was
+ * running, so every nanosecond of a frame is counted once, against
+ * whatever stage it was spent in.
+ *
+ * With no Profiler (a null pointer) a scope is one branch, and with
+ * NO_PROFILING defined, scopes are compiled out altogether.
+ *
+ * What it has to show: the last frame's stages and counters (overlay()),
+ * averages since the last summary as a JSON line (write_summary()), and
+ * a Chrome trace (chrome://tracing, or Perfetto), where frames and
+ * outermost scopes are spans and the stage times and counters of every
+ * frame are counter tracks.
+ *
+ * Only to be used from one thread at a time.
+ */
+
+enum Profile_stage {
+	/* Anything not in a scope */
+	stage_other,
+	stage_clear,
+	stage_project,
+	stage_cull,
+	stage_raster,
+	stage_present,
+	n_profile_stages
+};
+
+extern const char *const profile_stage_names[n_profile_stages];
+
+/* Counts for a frame, from Render_stats and the presenter */
+struct Profile_counters {
+	/* Triangles of every object looked at */
+	size_t triangles_submitted;
+	/* Skipped for being off-screen, facing away or hidden */
+	size_t triangles_culled;
+	/* Set up and scanned */
+	size_t triangles_rasterized;
+	/* Cells the scan got to, and those behind something already there */
+	size_t cells_tested;
+	size_t depth_rejects;
+	/* Sent to the terminal */
+	size_t bytes_written;
+};
+
+class Profiler {
+	public:
+		Profiler();
+		/* Finishes the trace, if there is one */
+		~Profiler();
+		/* Starts a Chrome trace in path. Returns -1 (errno set) on error. */
+		int open_trace(const char *path);
+
+		void begin_frame();
+		void end_frame(const Profile_counters &c);
+
+		/*
+		 * Makes s the stage under way, returning the one that was, to go
+		 * back to with leave(). Profile_scope does both.
+		 */
+		Profile_stage enter(Profile_stage s)
+		{
+			long t = now_ns();
+			this->stage_ns[this->stage] += t - this->last_ns;
+			this->last_ns = t;
+			if (this->depth++ == 0)
+				this->scope_start_ns = t;
+			Profile_stage was = this->stage;
+			this->stage = s;
+			return was;
+		}
+		void leave(Profile_stage was)
+		{
+			long t = now_ns();
+			this->stage_ns[this->stage] += t - this->last_ns;
+			this->last_ns = t;
+			if (--this->depth == 0 && this->trace)
+				this->trace_span(profile_stage_names[this->stage],
+						this->scope_start_ns, t);
+			this->stage = was;
+		}
+
+		/*
+		 * Counts ns against stage s in this frame, for work done for it on
+		 * another thread; nothing else's time is taken off for it, so the
+		 * stages can add up to more than the frame took
+		 */
+		void add(Profile_stage s, long ns) { this->stage_ns[s] += ns; }
+
+		/* The last finished frame */
+		struct Frame {
+			long total_ns;
+			long stage_ns[n_profile_stages];
+			Profile_counters counters;
+		};
+		const Frame &last() const { return last_frame; }
+		/*
+		 * One line of the last frame's figures, for showing on screen, in
+		 * at most len bytes (including the terminating 0)
+		 */
+		void overlay(char *buf, size_t len) const;
+		/*
+		 * Writes averages (and the worst frame time) since the last
+		 * summary as a line of JSON, and starts again
+		 */
+		void write_summary(FILE *out);
+
+	private:
+		Profiler(const Profiler &);
+		Profiler &operator=(const Profiler &);
+
+		static long now_ns()
+		{
+			struct timespec t;
+			clock_gettime(CLOCK_MONOTONIC, &t);
+			return t.tv_sec * 1000000000l + t.tv_nsec;
+		}
+		void trace_span(const char *name, long start_ns, long end_ns);
+
+		Profile_stage stage;
+		/* Scopes open */
+		int depth;
+		long last_ns, frame_start_ns, scope_start_ns;
+		long stage_ns[n_profile_stages];
+		unsigned long frame_no;
+		Frame last_frame;
+
+		/* Totals since the last summary */
+		unsigned long sum_frames;
+		Frame sum;
+		long max_ns;
+
+		FILE *trace;
+		/* Everything in the trace is timed from here */
+		long trace_start_ns;
+};
+
+#ifndef NO_PROFILING
+class Profile_scope {
+	public:
+		Profile_scope(Profiler *p, Profile_stage s) : p(p), was(stage_other)
+		{
+			if (p)
+				was = p->enter(s);
+		}
+		~Profile_scope()
+		{
+			if (p)
+				p->leave(was);
+		}
+	private:
+		Profiler *p;
+		Profile_stage was;
+};
+#else
+class Profile_scope {
+	public:
+		Profile_scope(Profiler *, Profile_stage) {}
+};
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "project.hh"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+/*
+ * For each vertex P, with A = P - C0:
+ *   q = A.Cf is how far in front of the camera it is,
+ *   the plane is hit at (A.Cu, A.Cr) * d/q,
+ *   and the squared distance is A.A.
+ * I worked this out on paper; explaining it in comments would be a pain.
+ * The vector kernels below do exactly the same sums in the same order.
+ */
+static void project_scalar(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t begin, size_t n, double *a,
+		double *b, double *dist, unsigned char *visible)
+{
+	Vec3 C0 = c.origin;
+	Vec3 Cr = c.right;
+	Vec3 Cu = c.up;
+	Vec3 Cf = c.forward;
+	double d = c.depth;
+
+	for (size_t i = begin; i < n; ++i) {
+		Vec3 A = vec_sub(Vec3(x[i], y[i], z[i]), C0);
+		double q = vec_dot(A, Cf);
+		/* Behind the camera, or in the plane of its back */
+		visible[i] = !(!q || q < 0);
+		double l = d/q;
+		b[i] = vec_dot(A, Cr) * l;
+		a[i] = vec_dot(A, Cu) * l;
+		dist[i] = vec_dot(A, A);
+	}
+}
+
+#if HAVE_X86_KERNELS
+static void project_sse2(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, double *a, double *b,
+		double *dist, unsigned char *visible)
+{
+	const __m128d c0x = _mm_set1_pd(c.origin.x);
+	const __m128d c0y = _mm_set1_pd(c.origin.y);
+	const __m128d c0z = _mm_set1_pd(c.origin.z);
+	const __m128d crx = _mm_set1_pd(c.right.x);
+	const __m128d cry = _mm_set1_pd(c.right.y);
+	const __m128d crz = _mm_set1_pd(c.right.z);
+	const __m128d cux = _mm_set1_pd(c.up.x);
+	const __m128d cuy = _mm_set1_pd(c.up.y);
+	const __m128d cuz = _mm_set1_pd(c.up.z);
+	const __m128d cfx = _mm_set1_pd(c.forward.x);
+	const __m128d cfy = _mm_set1_pd(c.forward.y);
+	const __m128d cfz = _mm_set1_pd(c.forward.z);
+	const __m128d d = _mm_set1_pd(c.depth);
+	const __m128d zero = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d ax = _mm_sub_pd(_mm_loadu_pd(x + i), c0x);
+		__m128d ay = _mm_sub_pd(_mm_loadu_pd(y + i), c0y);
+		__m128d az = _mm_sub_pd(_mm_loadu_pd(z + i), c0z);
+
+		__m128d q = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, cfx),
+					_mm_mul_pd(ay, cfy)), _mm_mul_pd(az, cfz));
+		/* Not (q <= 0), which lets NaNs through like the scalar test does */
+		int vis = _mm_movemask_pd(_mm_cmpnle_pd(q, zero));
+		__m128d l = _mm_div_pd(d, q);
+
+		__m128d r = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, crx),
+					_mm_mul_pd(ay, cry)), _mm_mul_pd(az, crz));
+		__m128d u = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, cux),
+					_mm_mul_pd(ay, cuy)), _mm_mul_pd(az, cuz));
+		__m128d s = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, ax),
+					_mm_mul_pd(ay, ay)), _mm_mul_pd(az, az));
+
+		_mm_storeu_pd(b + i, _mm_mul_pd(r, l));
+		_mm_storeu_pd(a + i, _mm_mul_pd(u, l));
+		_mm_storeu_pd(dist + i, s);
+		visible[i] = vis & 1;
+		visible[i + 1] = (vis >> 1) & 1;
+	}
+	project_scalar(c, x, y, z, i, n, a, b, dist, visible);
+}
+
+__attribute__((target("avx2")))
+static void project_avx2(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, double *a, double *b,
+		double *dist, unsigned char *visible)
+{
+	const __m256d c0x = _mm256_set1_pd(c.origin.x);
+	const __m256d c0y = _mm256_set1_pd(c.origin.y);
+	const __m256d c0z = _mm256_set1_pd(c.origin.z);
+	const __m256d crx = _mm256_set1_pd(c.right.x);
+	const __m256d cry = _mm256_set1_pd(c.right.y);
+	const __m256d crz = _mm256_set1_pd(c.right.z);
+	const __m256d cux = _mm256_set1_pd(c.up.x);
+	const __m256d cuy = _mm256_set1_pd(c.up.y);
+	const __m256d cuz = _mm256_set1_pd(c.up.z);
+	const __m256d cfx = _mm256_set1_pd(c.forward.x);
+	const __m256d cfy = _mm256_set1_pd(c.forward.y);
+	const __m256d cfz = _mm256_set1_pd(c.forward.z);
+	const __m256d d = _mm256_set1_pd(c.depth);
+	const __m256d zero = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d ax = _mm256_sub_pd(_mm256_loadu_pd(x + i), c0x);
+		__m256d ay = _mm256_sub_pd(_mm256_loadu_pd(y + i), c0y);
+		__m256d az = _mm256_sub_pd(_mm256_loadu_pd(z + i), c0z);
+
+		/* Separate multiplies and adds: no FMA, so rounding matches */
+		__m256d q = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, cfx),
+					_mm256_mul_pd(ay, cfy)), _mm256_mul_pd(az, cfz));
+		int vis = _mm256_movemask_pd(_mm256_cmp_pd(q, zero, _CMP_NLE_UQ));
+		__m256d l = _mm256_div_pd(d, q);
+
+		__m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, crx),
+					_mm256_mul_pd(ay, cry)), _mm256_mul_pd(az, crz));
+		__m256d u = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, cux),
+					_mm256_mul_pd(ay, cuy)), _mm256_mul_pd(az, cuz));
+		__m256d s = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, ax),
+					_mm256_mul_pd(ay, ay)), _mm256_mul_pd(az, az));
+
+		_mm256_storeu_pd(b + i, _mm256_mul_pd(r, l));
+		_mm256_storeu_pd(a + i, _mm256_mul_pd(u, l));
+		_mm256_storeu_pd(dist + i, s);
+		for (int j = 0; j < 4; ++j)
+			visible[i + j] = (vis >> j) & 1;
+	}
+	project_scalar(c, x, y, z, i, n, a, b, dist, visible);
+}
+#endif
+
+/*
+ * The same in float. The camera is rounded to float once, and each vertex
+ * as it is loaded, so that all the kernels start from the same numbers.
+ */
+struct Camera_basis_f {
+	float c0x, c0y, c0z, crx, cry, crz, cux, cuy, cuz, cfx, cfy, cfz, d;
+
+	Camera_basis_f(const Camera_basis &c)
+		: c0x(c.origin.x), c0y(c.origin.y), c0z(c.origin.z),
+		crx(c.right.x), cry(c.right.y), crz(c.right.z),
+		cux(c.up.x), cuy(c.up.y), cuz(c.up.z),
+		cfx(c.forward.x), cfy(c.forward.y), cfz(c.forward.z),
+		d(c.depth) {}
+};
+
+static void project_scalar_f(const Camera_basis_f &c, const double *x,
+		const double *y, const double *z, size_t begin, size_t n, float *a,
+		float *b, float *dist, unsigned char *visible)
+{
+	for (size_t i = begin; i < n; ++i) {
+		float ax = (float) x[i] - c.c0x;
+		float ay = (float) y[i] - c.c0y;
+		float az = (float) z[i] - c.c0z;
+		float q = ax * c.cfx + ay * c.cfy + az * c.cfz;
+		visible[i] = !(!q || q < 0);
+		float l = c.d / q;
+		b[i] = (ax * c.crx + ay * c.cry + az * c.crz) * l;
+		a[i] = (ax * c.cux + ay * c.cuy + az * c.cuz) * l;
+		dist[i] = ax * ax + ay * ay + az * az;
+	}
+}
+
+#if HAVE_X86_KERNELS
+static void project_sse2_f(const Camera_basis_f &c, const double *x,
+		const double *y, const double *z, size_t n, float *a, float *b,
+		float *dist, unsigned char *visible)
+{
+	const __m128 c0x = _mm_set1_ps(c.c0x);
+	const __m128 c0y = _mm_set1_ps(c.c0y);
+	const __m128 c0z = _mm_set1_ps(c.c0z);
+	const __m128 crx = _mm_set1_ps(c.crx);
+	const __m128 cry = _mm_set1_ps(c.cry);
+	const __m128 crz = _mm_set1_ps(c.crz);
+	const __m128 cux = _mm_set1_ps(c.cux);
+	const __m128 cuy = _mm_set1_ps(c.cuy);
+	const __m128 cuz = _mm_set1_ps(c.cuz);
+	const __m128 cfx = _mm_set1_ps(c.cfx);
+	const __m128 cfy = _mm_set1_ps(c.cfy);
+	const __m128 cfz = _mm_set1_ps(c.cfz);
+	const __m128 d = _mm_set1_ps(c.d);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		/* Four doubles in, four floats out */
+		__m128 px = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(x + i)),
+				_mm_cvtpd_ps(_mm_loadu_pd(x + i + 2)));
+		__m128 py = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(y + i)),
+				_mm_cvtpd_ps(_mm_loadu_pd(y + i + 2)));
+		__m128 pz = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(z + i)),
+				_mm_cvtpd_ps(_mm_loadu_pd(z + i + 2)));
+		__m128 ax = _mm_sub_ps(px, c0x);
+		__m128 ay = _mm_sub_ps(py, c0y);
+		__m128 az = _mm_sub_ps(pz, c0z);
+
+		__m128 q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, cfx),
+					_mm_mul_ps(ay, cfy)), _mm_mul_ps(az, cfz));
+		int vis = _mm_movemask_ps(_mm_cmpnle_ps(q, zero));
+		__m128 l = _mm_div_ps(d, q);
+
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, crx),
+					_mm_mul_ps(ay, cry)), _mm_mul_ps(az, crz));
+		__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, cux),
+					_mm_mul_ps(ay, cuy)), _mm_mul_ps(az, cuz));
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ax),
+					_mm_mul_ps(ay, ay)), _mm_mul_ps(az, az));
+
+		_mm_storeu_ps(b + i, _mm_mul_ps(r, l));
+		_mm_storeu_ps(a + i, _mm_mul_ps(u, l));
+		_mm_storeu_ps(dist + i, s);
+		for (int j = 0; j < 4; ++j)
+			visible[i + j] = (vis >> j) & 1;
+	}
+	project_scalar_f(c, x, y, z, i, n, a, b, dist, visible);
+}
+
+__attribute__((target("avx2")))
+static void project_avx2_f(const Camera_basis_f &c, const double *x,
+		const double *y, const double *z, size_t n, float *a, float *b,
+		float *dist, unsigned char *visible)
+{
+	const __m256 c0x = _mm256_set1_ps(c.c0x);
+	const __m256 c0y = _mm256_set1_ps(c.c0y);
+	const __m256 c0z = _mm256_set1_ps(c.c0z);
+	const __m256 crx = _mm256_set1_ps(c.crx);
+	const __m256 cry = _mm256_set1_ps(c.cry);
+	const __m256 crz = _mm256_set1_ps(c.crz);
+	const __m256 cux = _mm256_set1_ps(c.cux);
+	const __m256 cuy = _mm256_set1_ps(c.cuy);
+	const __m256 cuz = _mm256_set1_ps(c.cuz);
+	const __m256 cfx = _mm256_set1_ps(c.cfx);
+	const __m256 cfy = _mm256_set1_ps(c.cfy);
+	const __m256 cfz = _mm256_set1_ps(c.cfz);
+	const __m256 d = _mm256_set1_ps(c.d);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		/* Eight doubles in, eight floats out */
+		__m256 px = _mm256_insertf128_ps(_mm256_castps128_ps256(
+					_mm256_cvtpd_ps(_mm256_loadu_pd(x + i))),
+				_mm256_cvtpd_ps(_mm256_loadu_pd(x + i + 4)), 1);
+		__m256 py = _mm256_insertf128_ps(_mm256_castps128_ps256(
+					_mm256_cvtpd_ps(_mm256_loadu_pd(y + i))),
+				_mm256_cvtpd_ps(_mm256_loadu_pd(y + i + 4)), 1);
+		__m256 pz = _mm256_insertf128_ps(_mm256_castps128_ps256(
+					_mm256_cvtpd_ps(_mm256_loadu_pd(z + i))),
+				_mm256_cvtpd_ps(_mm256_loadu_pd(z + i + 4)), 1);
+		__m256 ax = _mm256_sub_ps(px, c0x);
+		__m256 ay = _mm256_sub_ps(py, c0y);
+		__m256 az = _mm256_sub_ps(pz, c0z);
+
+		/* Separate multiplies and adds: no FMA, so rounding matches */
+		__m256 q = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, cfx),
+					_mm256_mul_ps(ay, cfy)), _mm256_mul_ps(az, cfz));
+		int vis = _mm256_movemask_ps(_mm256_cmp_ps(q, zero, _CMP_NLE_UQ));
+		__m256 l = _mm256_div_ps(d, q);
+
+		__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, crx),
+					_mm256_mul_ps(ay, cry)), _mm256_mul_ps(az, crz));
+		__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, cux),
+					_mm256_mul_ps(ay, cuy)), _mm256_mul_ps(az, cuz));
+		__m256 s = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, ax),
+					_mm256_mul_ps(ay, ay)), _mm256_mul_ps(az, az));
+
+		_mm256_storeu_ps(b + i, _mm256_mul_ps(r, l));
+		_mm256_storeu_ps(a + i, _mm256_mul_ps(u, l));
+		_mm256_storeu_ps(dist + i, s);
+		for (int j = 0; j < 8; ++j)
+			visible[i + j] = (vis >> j) & 1;
+	}
+	project_scalar_f(c, x, y, z, i, n, a, b, dist, visible);
+}
+#endif
+
+int projection_kernel_supported(Projection_kernel k)
+{
+	switch (k) {
+		case proj_scalar:
+			return 1;
+#if HAVE_X86_KERNELS
+		case proj_sse2:
+			return __builtin_cpu_supports("sse2");
+		case proj_avx2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return 0;
+	}
+}
+
+const char *projection_kernel_name(Projection_kernel k)
+{
+	switch (k) {
+		case proj_sse2:
+			return "sse2";
+		case proj_avx2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+static Projection_kernel pick_kernel()
+{
+	const char *want = getenv("TETRASPIN_PROJECTION");
+	if (want) {
+		Projection_kernel all[3] = {proj_scalar, proj_sse2, proj_avx2};
+		for (int i = 0; i < 3; ++i) {
+			if (!strcmp(want, projection_kernel_name(all[i])) &&
+					projection_kernel_supported(all[i]))
+				return all[i];
+		}
+	}
+	if (projection_kernel_supported(proj_avx2))
+		return proj_avx2;
+	if (projection_kernel_supported(proj_sse2))
+		return proj_sse2;
+	return proj_scalar;
+}
+
+Projection_kernel projection_kernel()
+{
+	/* Only checked once; thread-safe as a function-local static */
+	static const Projection_kernel k = pick_kernel();
+	return k;
+}
+
+void project_vertices(Projection_kernel k, const Camera_basis &c,
+		const double *x, const double *y, const double *z, size_t n,
+		double *a, double *b, double *dist, unsigned char *visible)
+{
+	switch (k) {
+#if HAVE_X86_KERNELS
+		case proj_avx2:
+			project_avx2(c, x, y, z, n, a, b, dist, visible);
+			return;
+		case proj_sse2:
+			project_sse2(c, x, y, z, n, a, b, dist, visible);
+			return;
+#endif
+		default:
+			project_scalar(c, x, y, z, 0, n, a, b, dist, visible);
+			return;
+	}
+}
+
+void project_vertices(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, double *a, double *b,
+		double *dist, unsigned char *visible)
+{
+	project_vertices(projection_kernel(), c, x, y, z, n, a, b, dist, visible);
+}
+
+void project_vertices(Projection_kernel k, const Camera_basis &c,
+		const double *x, const double *y, const double *z, size_t n,
+		float *a, float *b, float *dist, unsigned char *visible)
+{
+	Camera_basis_f cf(c);
+	switch (k) {
+#if HAVE_X86_KERNELS
+		case proj_avx2:
+			project_avx2_f(cf, x, y, z, n, a, b, dist, visible);
+			return;
+		case proj_sse2:
+			project_sse2_f(cf, x, y, z, n, a, b, dist, visible);
+			return;
+#endif
+		default:
+			project_scalar_f(cf, x, y, z, 0, n, a, b, dist, visible);
+			return;
+	}
+}
+
+void project_vertices(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, float *a, float *b,
+		float *dist, unsigned char *visible)
+{
+	project_vertices(projection_kernel(), c, x, y, z, n, a, b, dist, visible);
+}
@@ -0,0 +1,112 @@
+#ifndef PROJECT_H_I
+#define PROJECT_H_I
+
+#include <cstddef>
+#include <vector>
+
+#include "cow_vector.hh"
+#include "vec_ops.hh"
+
+/*
+ * Vertex positions, stored as separate arrays of x, y and z so that the
+ * projection kernels can load several vertices' worth of one component at
+ * once. The arrays may be borrowed, see cow_vector.hh.
+ */
+class Vertex_buffer {
+	public:
+		void push_back(Vec3 v)
+		{
+			xs.push_back(v.x);
+			ys.push_back(v.y);
+			zs.push_back(v.z);
+		}
+		Vec3 operator[](size_t i) const { return Vec3(xs[i], ys[i], zs[i]); }
+		size_t size() const { return xs.size(); }
+		void reserve(size_t n)
+		{
+			xs.reserve(n);
+			ys.reserve(n);
+			zs.reserve(n);
+		}
+
+		Cow_vector<double> xs, ys, zs;
+};
+
+/* The camera's position and axes, worked out once per frame */
+struct Camera_basis {
+	Vec3 origin;
+	Vec3 right;
+	Vec3 up;
+	Vec3 forward;
+	/* Distance from back of camera to plane */
+	double depth;
+};
+
+/*
+ * Vertices as the camera sees them: position on the camera plane (a is y, b
+ * is x, in plane units) and squared distance from the camera. visible is 0 if
+ * the line from the vertex to the camera doesn't cross the plane, in which
+ * case nothing using it gets drawn (and the rest is meaningless).
+ * In double or float, depending on the raster path (see raster.hh).
+ */
+template <typename T>
+struct Projected_vertices_t {
+	std::vector<T> a, b, dist;
+	std::vector<unsigned char> visible;
+
+	/* Makes room for n vertices. Never shrinks. */
+	void reserve(size_t n)
+	{
+		if (a.size() >= n)
+			return;
+		a.resize(n);
+		b.resize(n);
+		dist.resize(n);
+		visible.resize(n);
+	}
+};
+
+typedef Projected_vertices_t<double> Projected_vertices;
+
+enum Projection_kernel {
+	proj_scalar,
+	proj_sse2,
+	proj_avx2
+};
+
+/*
+ * Projects n vertices (x[i], y[i], z[i]) for the camera basis c into the
+ * arrays a, b, dist and visible.
+ * Which implementation is used is decided once, by what the CPU supports,
+ * unless the environment variable TETRASPIN_PROJECTION names one (scalar,
+ * sse2 or avx2). All of them do the same IEEE operations in the same order
+ * and never fuse multiplies into adds, so their results are identical to
+ * the last bit; the tolerance is zero, not just small.
+ */
+void project_vertices(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, double *a, double *b,
+		double *dist, unsigned char *visible);
+/* Same thing, but with a particular kernel (which must be supported) */
+void project_vertices(Projection_kernel k, const Camera_basis &c,
+		const double *x, const double *y, const double *z, size_t n,
+		double *a, double *b, double *dist, unsigned char *visible);
+
+/*
+ * In float: the positions are rounded to float first and everything after
+ * is done in float, twice as many vertices at a time. The kernels again
+ * agree to the last bit.
+ */
+void project_vertices(const Camera_basis &c, const double *x,
+		const double *y, const double *z, size_t n, float *a, float *b,
+		float *dist, unsigned char *visible);
+void project_vertices(Projection_kernel k, const Camera_basis &c,
+		const double *x, const double *y, const double *z, size_t n,
+		float *a, float *b, float *dist, unsigned char *visible);
+
+/* The kernel project_vertices() picked */
+Projection_kernel projection_kernel();
+/* Whether the CPU (and compiler) can run kernel k */
+int projection_kernel_supported(Projection_kernel k);
+const char *projection_kernel_name(Projection_kernel k);
+
+#endif
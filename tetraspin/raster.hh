@@ -0,0 +1,245 @@
+#ifndef RASTER_H_I
+#define RASTER_H_I
+
+#include <cstdint>
+#include <math.h>
+#include <vector>
+
+#include "framebuffer.hh"
+#include "project.hh"
+#include "vec_ops.hh"
+
+struct Triangle_style;
+
+/*
+ * The raster pipeline (projection, triangle setup, edge terms, depth
+ * interpolation and the depth buffer) is written once, as templates over one
+ * of the formats below, and Renderer picks one when it is constructed (see
+ * Raster_format). Each format says what type each stage works in:
+ *   coord: projected vertices and triangle setup
+ *   term:  the tabulated row/column halves of the edge functions, which
+ *          are added together for every cell scanned
+ *   depth: what the depth buffer stores
+ *   dist:  a cell's distance as it is worked out, before it is stored
+ * Distances are squared distances from the camera throughout, as
+ * project_vertices() gives them.
+ */
+
+/*
+ * The reference: everything in double. What every version of tetraspin so
+ * far has drawn, and exactly the same however many threads draw it.
+ */
+struct Double_raster {
+	typedef double coord;
+	typedef double term;
+	typedef double depth;
+	typedef double dist;
+
+	/*
+	 * Terms are always at the same scale, so the shift is ignored (and
+	 * triangles too thin for terms that make sense come out as infinities
+	 * or NaNs, which are never inside)
+	 */
+	static int term_shift(double) { return 0; }
+	static term to_term(coord v, int) { return v; }
+	static term one(int) { return 1.0; }
+	static depth to_depth(coord d) { return d; }
+	static double depth_units(double d) { return d; }
+	static double from_depth(depth d) { return d; }
+	static dist interpolate(depth d0, depth dc1, depth dc2, Vec2_t<term> c,
+			int)
+	{
+		return d0 + dc1*c.x + dc2*c.y;
+	}
+	/*
+	 * How far below the nearest vertex a cell's distance can come out from
+	 * rounding, for a triangle whose |dist0| + |dc1| + |dc2| is m
+	 */
+	static double slack(double m) { return 1e-9 * m; }
+	/* The same for a whole object, given its nearest and farthest points */
+	static double object_slack(double nearest, double) { return 1e-9 * nearest; }
+};
+
+/*
+ * Everything in float: half the bytes for projected vertices, edge terms
+ * and the depth buffer, and twice the SIMD lanes for projection. Vertices
+ * are rounded to float before anything is done to them, so far from the
+ * origin they lose more than the rest of the pipeline does.
+ * Precision: float has a 24-bit mantissa, so edge terms are good to about
+ * 6e-8 of their size. Within a triangle they are at most a few units, which
+ * puts edges within about 1e-4 cells of where double has them at 200 or so
+ * columns; a cell right on an edge can land on the other side, and that is
+ * the only sort of difference there is. Distances are good to about 1e-7
+ * relative, so only surfaces closer together than that (relative to their
+ * distance) can come out in a different order.
+ */
+struct Float_raster {
+	typedef float coord;
+	typedef float term;
+	typedef float depth;
+	typedef float dist;
+
+	static int term_shift(double) { return 0; }
+	static term to_term(coord v, int) { return v; }
+	static term one(int) { return 1.0f; }
+	static depth to_depth(coord d) { return d; }
+	static double depth_units(double d) { return d; }
+	static double from_depth(depth d) { return d; }
+	static dist interpolate(depth d0, depth dc1, depth dc2, Vec2_t<term> c,
+			int)
+	{
+		return d0 + dc1*c.x + dc2*c.y;
+	}
+	static double slack(double m) { return 1e-6 * m; }
+	static double object_slack(double, double farthest)
+	{
+		return 3e-6 * farthest;
+	}
+};
+
+/*
+ * Fixed point: vertices are projected and triangles set up in double as
+ * usual, but the edge terms are rounded to 16.16 fixed point and the depth
+ * buffer holds distances as integers, so scanning (where the time goes) is
+ * all integer adds and compares, and its results don't depend on anything
+ * about the platform's floating point. Even the setup is the same
+ * everywhere, as long as doubles are IEEE and multiplies aren't fused into
+ * adds (the same as the projection kernels need).
+ * Precision: terms are normally good to 2^-17, so edges are within 2^-16 of
+ * where double has them: less than 0.003 cells at 200 columns, 0.007 at 500.
+ * The row and column terms of a sliver seen nearly edge-on can each be huge
+ * while adding up to something small, though, so a triangle whose terms
+ * don't fit in 16.16 (with room to add two) gets fewer fractional bits,
+ * as many as do fit; a triangle that thin covers hardly anything anyway,
+ * and one that needs fewer than none isn't drawn.
+ * Distances are kept in 1/256ths, clamped at 2^22 (a distance of 2048,
+ * squared, which is farther than any scene here); interpolating one across
+ * a triangle is good to about 2^-15 of the difference between its
+ * vertices' distances.
+ */
+struct Fixed_raster {
+	typedef double coord;
+	typedef int32_t term;
+	typedef int32_t depth;
+	typedef int64_t dist;
+
+	static const int term_bits = 16;
+	static const int depth_bits = 8;
+
+	/*
+	 * Fractional bits for a triangle whose largest term is largest: sums
+	 * of two terms have to fit in a term. -1 if even whole numbers don't,
+	 * which takes a triangle too thin to cover any cell.
+	 */
+	static int term_shift(double largest)
+	{
+		int shift = term_bits;
+		while (shift >= 0 && !(largest * (1 << shift) < (1 << 29)))
+			--shift;
+		return shift;
+	}
+	/* Rounded to nearest by hand: floor() is a library call without SSE4.1 */
+	static term to_term(coord v, int shift)
+	{
+		double t = v * (1 << shift);
+		return (term) (t < 0 ? t - 0.5 : t + 0.5);
+	}
+	static term one(int shift) { return 1 << shift; }
+	static depth to_depth(coord d)
+	{
+		double t = d * (1 << depth_bits) + 0.5;
+		if (!(t > 0))
+			return 0;
+		if (t > (1 << 30))
+			return 1 << 30;
+		return (depth) t;
+	}
+	static double depth_units(double d) { return d * (1 << depth_bits); }
+	static double from_depth(depth d)
+	{
+		return d == INT32_MAX ? INFINITY : d / (double) (1 << depth_bits);
+	}
+	static dist interpolate(depth d0, depth dc1, depth dc2, Vec2_t<term> c,
+			int shift)
+	{
+		return d0 + (((dist) dc1 * c.x + (dist) dc2 * c.y) >> shift);
+	}
+	static double slack(double m) { return m / (1 << 15) + 2; }
+	static double object_slack(double, double farthest)
+	{
+		return 3 * farthest / (1 << 15) + 3;
+	}
+};
+
+enum Raster_format {
+	raster_double,
+	raster_float,
+	raster_fixed
+};
+
+/* Returns -1 if name isn't double, float or fixed */
+int raster_format_from_name(const char *name);
+const char *raster_format_name(Raster_format f);
+
+/*
+ * Everything scan_triangle needs to know about a triangle once it has been
+ * projected, worked out once per triangle rather than once per cell.
+ * A cell (y, x) has barycentric coordinates c = r(y) + c(x): the edge
+ * functions are affine, so they split into a term that only depends on the
+ * row and one that only depends on the column. Those terms are tabulated
+ * (including one row/column of margin either side for the edge test) and
+ * scanning a cell is then a couple of adds.
+ */
+template <typename F>
+struct Raster_triangle_t {
+	/* Cells to scan, inclusive, already clipped to the screen */
+	int y0, y1, x0, x1;
+	/* Distance at the first vertex and its change along each edge */
+	typename F::depth dist0, dc1, dc2;
+	/*
+	 * Where this triangle's terms start in the raster state's terms: row
+	 * terms for y0 - 1 .. y1 + 1, then column terms for x0 - 1 .. x1 + 1
+	 */
+	size_t terms;
+	/* Fractional bits in the terms, for fixed point */
+	int shift;
+	/* Where the symbols come from */
+	const Triangle_style *style;
+	/*
+	 * No cell of the triangle can be nearer than this (it is the nearest
+	 * vertex, less a little for rounding), in the depth buffer's units
+	 */
+	double nearest;
+};
+
+/*
+ * What a Renderer keeps for drawing in a particular format. Only the one it
+ * was constructed with exists, and everything that touches it is a template
+ * over the format, chosen once a frame.
+ */
+struct Raster_state_base {
+	virtual ~Raster_state_base() {}
+	/* Makes the screen height x width, and blank */
+	virtual void resize(int height, int width) = 0;
+};
+
+template <typename F>
+struct Raster_state : public Raster_state_base {
+	Raster_state(int height, int width) : screen(height, width) {}
+	void resize(int height, int width) { screen.resize(height, width); }
+
+	Framebuffer<typename F::depth> screen;
+	/* Vertices of the object being drawn as the camera sees them */
+	Projected_vertices_t<typename F::coord> projected;
+	/*
+	 * Storage for the row/column terms of the triangles being drawn. Only
+	 * ever grows, so steady-state drawing doesn't allocate.
+	 */
+	std::vector<Vec2_t<typename F::term> > terms;
+	/* Every visible triangle this frame, in drawing order, when binning */
+	std::vector<Raster_triangle_t<F> > frame_tris;
+	/* Distances in double, for Renderer::depth(), when they aren't already */
+	std::vector<double> depth_copy;
+};
+
+#endif
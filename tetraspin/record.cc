@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <condition_variable>
+#include <errno.h>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "present.hh"
+#include "render.hh"
+#include "scenes.hh"
+
+/*
+ * Renders a canned scene's camera path offline into a recording, with
+ * frames spread over as many threads as there are cores, and plays
+ * recordings back.
+ *
+ * Every frame of a scene's path only depends on its number (see
+ * scene_camera()), so each thread has a Renderer of its own and takes
+ * whichever frame is next. Frames are only encoded in order, though: the
+ * recording holds what the presenter would have sent, which is just the
+ * cells that changed since the frame before.
+ *
+ * Recordings are asciicast v2 (what asciinema records and plays), so
+ * anything that plays those will play these. There are no timestamps or
+ * environment in the header, so the same scene, size and frame count always
+ * make the same file, byte for byte.
+ *
+ * Usage: record [-s scene] [-g WxH] [-n frames] [-f fps] [-j threads]
+ *               [-r format] [-o file]
+ *        record -p file [-x speed]
+ */
+
+/* Frames rendered but not yet encoded, per thread rendering them */
+static const int slots_per_thread = 4;
+
+struct Recording {
+	const Scene *scene;
+	int width, height;
+	int frames;
+
+	/* One for each rendering thread, built before any of them start */
+	std::vector<std::unique_ptr<Renderer> > renderers;
+
+	/*
+	 * Finished frames waiting to be encoded, frame f in slot f % n_slots.
+	 * A thread can only render frame f once frame f - n_slots has been
+	 * encoded, so how far rendering gets ahead is bounded.
+	 */
+	int n_slots;
+	std::vector<std::vector<Render_symbol> > slots;
+	/* Which frame each slot holds, or -1 */
+	std::vector<int> ready;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	/* The next frame nobody has taken yet */
+	int next;
+	/* How many frames have been encoded */
+	int encoded;
+};
+
+static void render_main(Recording *rec, int id)
+{
+	Renderer *r = rec->renderers[id].get();
+	while (1) {
+		int f;
+		{
+			std::unique_lock<std::mutex> l(rec->lock);
+			f = rec->next++;
+			if (f >= rec->frames)
+				return;
+			while (f >= rec->encoded + rec->n_slots)
+				rec->changed.wait(l);
+		}
+
+		scene_camera(rec->scene, f, r);
+		Screen_span frame = r->render();
+		Render_symbol *dst = rec->slots[f % rec->n_slots].data();
+		for (int y = 0; y < rec->height; ++y)
+			memcpy(dst + (size_t) y * rec->width, frame[y],
+					rec->width * sizeof(Render_symbol));
+
+		std::lock_guard<std::mutex> l(rec->lock);
+		rec->ready[f % rec->n_slots] = f;
+		rec->changed.notify_all();
+	}
+}
+
+/* Writes len bytes at s as the inside of a JSON string */
+static void put_json_string(FILE *out, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(out, "\\u%04x", c);
+		else
+			putc(c, out);
+	}
+}
+
+static void put_event(FILE *out, double t, const char *s, size_t len)
+{
+	fprintf(out, "[%.6f, \"o\", \"", t);
+	put_json_string(out, s, len);
+	fputs("\"]\n", out);
+}
+
+static int record(const Scene *scene, int width, int height, int frames,
+		double fps, int threads, Raster_format format, FILE *out)
+{
+	Recording rec;
+	rec.scene = scene;
+	rec.width = width;
+	rec.height = height;
+	rec.frames = frames;
+	rec.n_slots = threads * slots_per_thread;
+	rec.slots.resize(rec.n_slots);
+	for (int i = 0; i < rec.n_slots; ++i)
+		rec.slots[i].resize((size_t) width * height);
+	rec.ready.assign(rec.n_slots, -1);
+	rec.next = 0;
+	rec.encoded = 0;
+	for (int i = 0; i < threads; ++i) {
+		rec.renderers.emplace_back(new Renderer(height, width, 3.0,
+					scene->max_objects, 1, format));
+		scene->build(rec.renderers.back().get());
+	}
+
+	fprintf(out, "{\"version\": 2, \"width\": %d, \"height\": %d, "
+			"\"title\": \"tetraspin %s\"}\n", width, height, scene->name);
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(render_main, &rec, i));
+
+	/* Frames go into the recording, not to a terminal */
+	Presenter presenter(Presenter::encode_only, height, width);
+	for (int f = 0; f < frames; ++f) {
+		int slot = f % rec.n_slots;
+		{
+			std::unique_lock<std::mutex> l(rec.lock);
+			while (rec.ready[slot] != f)
+				rec.changed.wait(l);
+		}
+		Screen_span frame = {rec.slots[slot].data(), width, height};
+		size_t len = presenter.encode(frame);
+		/* Frames that look the same as the one before aren't worth an event */
+		if (len)
+			put_event(out, f / fps, presenter.buffer(), len);
+
+		std::lock_guard<std::mutex> l(rec.lock);
+		rec.ready[slot] = -1;
+		rec.encoded = f + 1;
+		rec.changed.notify_all();
+	}
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	/* What the presenter would have done on the way out */
+	char trailer[64];
+	int len = snprintf(trailer, sizeof(trailer), "\x1b[0m\x1b[%d;1H\x1b[?25h",
+			height + 1);
+	put_event(out, frames / fps, trailer, len);
+	return ferror(out) ? -1 : 0;
+}
+
+static volatile sig_atomic_t playing = 1;
+
+static void stop(int sig)
+{
+	playing = 0;
+}
+
+/*
+ * Reads the inside of a JSON string at p (just past the opening quote) into
+ * s. Returns the position after the closing quote, or 0 if there isn't one.
+ */
+static const char *get_json_string(const char *p, std::string *s)
+{
+	s->clear();
+	while (*p && *p != '"') {
+		if (*p != '\\') {
+			*s += *p++;
+			continue;
+		}
+		++p;
+		switch (*p) {
+		case 'n': *s += '\n'; break;
+		case 'r': *s += '\r'; break;
+		case 't': *s += '\t'; break;
+		case 'b': *s += '\b'; break;
+		case 'f': *s += '\f'; break;
+		case 'u': {
+			unsigned c;
+			if (sscanf(p + 1, "%4x", &c) != 1)
+				return 0;
+			/* Anything past Latin-1 is left to real asciicast players */
+			*s += (char) c;
+			p += 4;
+			break;
+		}
+		case 0:
+			return 0;
+		default:
+			*s += *p;
+		}
+		++p;
+	}
+	return *p == '"' ? p + 1 : 0;
+}
+
+/* Writes the output events of recording path to stdout, speed times as fast */
+static int play(const char *path, double speed)
+{
+	FILE *in = fopen(path, "r");
+	if (!in) {
+		perror(path);
+		return -1;
+	}
+
+	struct sigaction sa = {};
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	char *line = 0;
+	size_t cap = 0;
+	int lineno = 0;
+	int ret = 0;
+	std::string data;
+	while (playing && getline(&line, &cap, in) > 0) {
+		/* The header is the first line; everything after is an event */
+		if (++lineno == 1)
+			continue;
+		double t;
+		char code[8];
+		int n = 0;
+		if (sscanf(line, "[%lf, \"%7[^\"]\", \"%n", &t, code, &n) != 2 || !n
+				|| !get_json_string(line + n, &data)) {
+			fprintf(stderr, "%s:%d: not an asciicast event\n", path, lineno);
+			ret = -1;
+			break;
+		}
+		/* Only output matters; there's no input to replay */
+		if (strcmp(code, "o"))
+			continue;
+
+		double at = t / speed;
+		struct timespec when = start;
+		when.tv_sec += (time_t) at;
+		when.tv_nsec += (long) ((at - (time_t) at) * 1e9);
+		if (when.tv_nsec >= 1000000000l) {
+			++when.tv_sec;
+			when.tv_nsec -= 1000000000l;
+		}
+		while (playing && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&when, 0) == EINTR)
+			;
+		if (write(1, data.data(), data.size()) < 0)
+			break;
+	}
+	free(line);
+	fclose(in);
+
+	/* Cut short, the terminal could be left in any state */
+	if (!playing) {
+		const char *reset = "\x1b[0m\x1b[?25h\n";
+		if (write(1, reset, strlen(reset)) < 0)
+			return -1;
+	}
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s scene] [-g WxH] [-n frames] [-f fps] "
+			"[-j threads] [-r double|float|fixed] [-o file]\n"
+			"       %s -p file [-x speed]\nscenes:\n", prog, prog);
+	print_scenes(stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	/*
+	 * Parsed as bench and verify do, though only one of each is wanted:
+	 * the last, if it comes to that
+	 */
+	std::vector<const Scene *> which(1, &scenes[0]);
+	std::vector<std::pair<int, int> > sizes(1, std::make_pair(56, 24));
+	std::vector<int> workers(1, (int) std::thread::hardware_concurrency());
+	std::vector<Raster_format> formats(1, raster_double);
+	/* Once round, for the scenes that go round at 0.02 a frame */
+	int frames = 315;
+	double fps = 10.0;
+	const char *out_path = 0;
+	const char *play_path = 0;
+	double speed = 1.0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:g:n:f:j:r:o:p:x:h")) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_scenes(optarg, &which) < 0)
+				usage(argv[0]);
+			break;
+		case 'g':
+			if (parse_sizes(optarg, &sizes) < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			if (frames < 1)
+				usage(argv[0]);
+			break;
+		case 'f':
+			fps = atof(optarg);
+			if (!(fps > 0.0))
+				usage(argv[0]);
+			break;
+		case 'j':
+			if (parse_workers(optarg, &workers) < 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (parse_formats(optarg, &formats) < 0)
+				usage(argv[0]);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'p':
+			play_path = optarg;
+			break;
+		case 'x':
+			speed = atof(optarg);
+			if (!(speed > 0.0))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		usage(argv[0]);
+
+	if (play_path)
+		return play(play_path, speed) < 0;
+
+	int threads = std::max(workers.back(), 1);
+	FILE *out = stdout;
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			perror(out_path);
+			return 1;
+		}
+	}
+	int ret = record(which.back(), sizes.back().first, sizes.back().second,
+			frames, fps, threads, formats.back(), out);
+	if (out != stdout && fclose(out) != 0)
+		ret = -1;
+	if (ret < 0) {
+		fprintf(stderr, "%s: write failed\n", out_path ? out_path : "stdout");
+		return 1;
+	}
+	return 0;
+}
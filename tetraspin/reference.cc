@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "reference.hh"
+
+Reference_renderer::Reference_renderer(int scr_y, int scr_x, double c_d)
+	: screen_x(scr_x), screen_y(scr_y), camera_depth(c_d), dist_scale(1.0)
+{
+}
+
+void Reference_renderer::render(const Renderer &r)
+{
+	/* First, clear screen */
+	size_t cells = (size_t) this->screen_x * this->screen_y;
+	this->screen.assign(cells, Render_symbol(' ', fg_none, bg_none));
+	/* Everything should overwrite an unwritten cell */
+	this->distance.assign(cells, INFINITY);
+
+	double cx = r.camera_xangle;
+	double cz = r.camera_zangle;
+	Camera_basis &c = this->basis;
+	c.origin = r.camera_pos;
+	c.right = Vec3(cos(cx), sin(cx), 0);
+	c.up = Vec3(sin(-cz)*sin(cx), sin(cz)*cos(cx), cos(cz));
+	c.forward = vec_cross(c.up, c.right);
+	c.depth = this->camera_depth;
+
+	/* Iterate through objects and draw them */
+	for (const Render_object *obj = r.objects.begin(); obj != r.objects.end();
+			++obj)
+		this->draw_object(obj);
+}
+
+void Reference_renderer::draw_object(const Render_object *obj)
+{
+	/*
+	 * An object somewhere other than where its model is gets drawn the way
+	 * the renderer defines it: by looking at the model from where the
+	 * camera is, relative to it
+	 */
+	Camera_basis world = this->basis;
+	const Transform &t = obj->transform;
+	this->dist_scale = 1.0;
+	if (!t.is_identity()) {
+		this->basis.origin = t.to_model(world.origin);
+		this->basis.right = t.to_model_dir(world.right);
+		this->basis.up = t.to_model_dir(world.up);
+		this->basis.forward = t.to_model_dir(world.forward);
+		this->dist_scale = t.scale * t.scale;
+	}
+	size_t n_tria = obj->n_triangles();
+	for (size_t j = 0; j < n_tria; ++j)
+		this->draw_triangle(obj, j);
+	this->basis = world;
+}
+
+void Reference_renderer::draw_triangle(const Render_object *obj, size_t tri)
+{
+	/*
+	 * 1: find on-screen coordinates and distances from screen of triangle
+	 * vertices
+	 */
+
+	Vec3 scs[3];
+	if (!this->screen_project(obj, tri, scs))
+		return;
+
+	/* Triangles are thin and cannot be seen side-on */
+	for (int i = 0; i < 3; ++i) {
+		for (int j = i+1; j <3; ++j) {
+			if ((scs[i][0] - scs[j][0]) || (scs[i][1] - scs[j][1]))
+				continue;
+			return;
+		}
+	}
+
+	/*
+	 * 2: shade in area bounded by all cells intersected by edges of triangle,
+	 * recording approximate distance from each cell to triangle (this is not a
+	 * serious program, so a little laziness is excusable).
+	 */
+	/*
+	 * Coordinates are relative to centre of screen in scs, but need to convert
+	 * to characters (8pxX15px on my terminal) to write to screen. Multiply by
+	 * screen_x/2.5 (for x) (5 unit wide camera plane) or (8/15)*screen_x/(2.5)
+	 * (for y)
+	 */
+	double ys = 15.0/8.0;
+	double scr_x_c = this->screen_x / 5.0;
+	double scr_y_c = scr_x_c / ys;
+
+	for (int i = 0; i < 3; ++i) {
+		scs[i][1] *= scr_x_c;
+		scs[i][0] *= scr_y_c;
+	}
+
+	/* Anticlockwise on screen (x right, y up) is the front */
+	if (obj->cull_backfaces) {
+		double winding = (scs[1][1] - scs[0][1]) * (scs[2][0] - scs[0][0]) -
+			(scs[1][0] - scs[0][0]) * (scs[2][1] - scs[0][1]);
+		if (winding < 0)
+			return;
+	}
+
+	double ymin = floor(std::min(scs[0][0], std::min(scs[1][0], scs[2][0])));
+	double ymax = ceil(std::max(scs[0][0], std::max(scs[1][0], scs[2][0])));
+	double xmin = floor(std::min(scs[0][1], std::min(scs[1][1], scs[2][1])));
+	double xmax = ceil(std::max(scs[0][1], std::max(scs[1][1], scs[2][1])));
+
+	/* Use convex combination trickery to shade triangle only */
+	double dist0 = scs[0][2];
+	double dc1 = scs[1][2] - dist0;
+	double dc2 = scs[2][2] - dist0;
+
+	Vec2 r0 = scs[0].xy();
+	Vec2 u1 = vec_sub(scs[1], scs[0]).xy();
+	Vec2 u2 = vec_sub(scs[2], scs[0]).xy();
+
+	const Render_object &g = obj->geometry();
+	const Triangle_style &style = obj->override_style ? obj->style :
+		g.styles[tri];
+
+	/* Features corrections to avoid drawing off-screen */
+	for (int y = (int) std::max(-1.0*screen_y/2, floor(ymin));
+			y <= std::min(1.0*screen_y/2 - 1.0, ceil(ymax)); ++y) {
+
+		for (int x = (int) std::max(-1.0*screen_x/2, floor(xmin));
+				x <= std::min(1.0*screen_x/2 - 1.0, ceil(xmax)); ++x) {
+
+			/* Map coordinates to array indices */
+			int yp = screen_y/2 - 1 - y;
+			int xp = x + screen_x/2;
+			size_t cell = (size_t) yp * screen_x + xp;
+			double dist = this->dist_calc(r0, u1, u2, dist0, dc1, dc2, y, x);
+			/* Nearer things cover farther ones */
+			if (dist >= this->distance[cell]) {
+				continue;
+			}
+			if (this->is_inside(r0, u1, u2, y, x)) {
+				/* Check if this is at the edge of a triangle */
+				int edge = 0;
+				for (int p = -1; p <= 1 && !edge; p+=2) {
+					for (int q = -1; q <=1 && !edge; q+=2) {
+						if (!(this->is_inside(r0, u1, u2, y+p, x+q))) {
+							this->screen[cell] = style.line_symbol;
+							this->distance[cell] = dist;
+							edge = 1;
+						}
+					}
+				}
+				if (edge)
+					continue;
+				/* If this isn't the edge of a triangle, draw accordingly */
+				this->screen[cell] = style.fill_symbol;
+				this->distance[cell] = dist;
+			}
+		}
+	}
+}
+
+int Reference_renderer::screen_project(const Render_object *obj, size_t tri,
+		Vec3 scs[3])
+{
+	/* Components: screen y coordinate, screen x coordinate, distance */
+	const Render_object &g = obj->geometry();
+	const Camera_basis &c = this->basis;
+	double d = c.depth;
+	double a, b, l, q;
+	Vec3 C0 = c.origin;
+	Vec3 Cr = c.right;
+	Vec3 Cu = c.up;
+	Vec3 Cf = c.forward;
+
+	for (int i = 0; i < 3; ++i) {
+		/* I worked this out on paper; explaining it in comments would be a pain */
+		Vec3 P = g.vertices[g.indices[3 * tri + i]];
+		Vec3 A = vec_sub(P, C0);
+		q = vec_dot(A, Cf);
+
+		if (!q or (vec_dot(Cf, A) < 0))
+			return 0;
+
+		l = d/q;
+		b = vec_dot(A, Cr) * l;
+		a = vec_dot(A, Cu) * l;
+
+		double dist = vec_dot(vec_sub(C0, P), vec_sub(C0, P));
+		if (this->dist_scale != 1.0)
+			dist *= this->dist_scale;
+		scs[i] = Vec3(a, b, dist);
+	}
+	return 1;
+}
+
+int Reference_renderer::is_inside(Vec2 r0, Vec2 u1, Vec2 u2, int y, int x)
+{
+	/*
+	 * These are guaranteed to exist because we earlier eliminated the case
+	 * where any of scs[0] [1] or [2] have equal [0] and [1] components
+	 */
+	Vec2 v1 = vec_recip2(u1, u2);
+	Vec2 v2 = vec_recip2(u2, u1);
+
+	Vec2 r = vec_sub(Vec2(y*1.0, x*1.0), r0);
+	double c1 = vec_dot(r, v1);
+	double c2 = vec_dot(r, v2);
+	return (c1 <= 1.0 && c1 >= 0.0 && c2 <=1.0 && c2 >= 0.0 && (c1 + c2) <= 1.0);
+}
+
+double Reference_renderer::dist_calc(Vec2 r0, Vec2 u1, Vec2 u2, double dist0,
+		double dc1, double dc2, int y, int x)
+{
+	Vec2 v1 = vec_recip2(u1, u2);
+	Vec2 v2 = vec_recip2(u2, u1);
+	Vec2 r = vec_sub(Vec2(y*1.0, x*1.0), r0);
+	return (dist0 + dc1*vec_dot(r, v1) + dc2*vec_dot(r, v2));
+}
+
+Screen_span Reference_renderer::symbols() const
+{
+	Screen_span s = {this->screen.data(), this->screen_x, this->screen_y};
+	return s;
+}
+
+Depth_span Reference_renderer::depth() const
+{
+	Depth_span s = {this->distance.data(), this->screen_x, this->screen_y};
+	return s;
+}
+
+uint64_t frame_hash(Screen_span symbols, Depth_span depth)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (int y = 0; y < symbols.height; ++y) {
+		for (int x = 0; x < symbols.width; ++x) {
+			unsigned char bytes[sizeof(Render_symbol) + sizeof(double)];
+			memcpy(bytes, &symbols[y][x], sizeof(Render_symbol));
+			memcpy(bytes + sizeof(Render_symbol), &depth[y][x],
+					sizeof(double));
+			for (size_t i = 0; i < sizeof(bytes); ++i) {
+				h ^= bytes[i];
+				h *= 1099511628211ull;
+			}
+		}
+	}
+	return h;
+}
@@ -0,0 +1,61 @@
+#ifndef REFERENCE_H_I
+#define REFERENCE_H_I
+
+#include <cstdint>
+#include <vector>
+
+#include "render.hh"
+
+/*
+ * The renderer as it was before any of it was made fast: every triangle of
+ * every object is projected on its own, one vertex at a time, and every cell
+ * of its bounding box is tested by working out its barycentric coordinates
+ * from scratch (see draw_triangle()). No culling, no tiles, no threads, no
+ * redrawing only what changed, and everything in double. The only changes
+ * are the ones that changed what gets drawn rather than how fast: vectors
+ * are Vec2/Vec3, objects are indexed meshes that can face away
+ * (cull_backfaces) or be instances (see Render_object), and cells are
+ * Render_symbols with their distances kept apart.
+ *
+ * It is here to check the real one against (see verify.cc): drawing in
+ * double, Renderer should come out the same to the last bit, distances
+ * included.
+ */
+class Reference_renderer {
+	public:
+		/* As for Renderer */
+		Reference_renderer(int scr_y, int scr_x, double c_depth);
+		/* Draws r's objects from where r's camera is */
+		void render(const Renderer &r);
+		Screen_span symbols() const;
+		Depth_span depth() const;
+
+	private:
+		void draw_object(const Render_object *obj);
+		void draw_triangle(const Render_object *obj, size_t tri);
+		/*
+		 * Projects triangle tri of obj into scs (screen y, screen x,
+		 * squared distance). Returns 0 if any of it is behind the camera.
+		 */
+		int screen_project(const Render_object *obj, size_t tri, Vec3 scs[3]);
+		int is_inside(Vec2 r0, Vec2 u1, Vec2 u2, int y, int x);
+		double dist_calc(Vec2 r0, Vec2 u1, Vec2 u2, double dist0, double dc1,
+				double dc2, int y, int x);
+
+		int screen_x, screen_y;
+		double camera_depth;
+		/* This frame's camera, in the coordinates of the object being drawn */
+		Camera_basis basis;
+		/* What distances are multiplied by to get them in the world */
+		double dist_scale;
+		std::vector<Render_symbol> screen;
+		std::vector<double> distance;
+};
+
+/*
+ * 64-bit FNV-1a of every cell of a frame: character, colours and distance
+ * (its bits, so -0 and 0 differ, and so would any two NaNs)
+ */
+uint64_t frame_hash(Screen_span symbols, Depth_span depth);
+
+#endif
@@ -1,143 +1,722 @@
 #include <stdlib.h>
+#include <string.h>
 #include <cstddef>
-#include <limits>
 #include <math.h>
 #include <algorithm>
+#include <utility>
 
 
 #include "render.hh"
 #include "vec_ops.hh"
 
 
-Render_symbol::Render_symbol(char c, enum fg_colour f,
-		enum bg_colour b)
+Render_object::Render_object()
 {
-	character = c;
-	fg = f;
-	bg = b;
-	/* Everything should overwrite an unwritten tile */
-	distance = std::numeric_limits<double>::infinity();
+	this->bounds_dirty = 1;
+	this->changed = 1;
+	this->cull_backfaces = 0;
+	this->override_style = 0;
 }
 
-std::string Render_symbol::get_string()
+Render_object::Render_object(const Shared_mesh &mesh, const Transform &t)
+	: mesh(mesh), transform(t)
 {
-	/*
-	 * Can get away with e.g. \x1b[0;41m, but not \x1b[41;0m as a colour
-	 * code. The brackets *are* important; otherwise, e.g. 'm' and
-	 * this->character get added together
-	 */
-	return (((((std::string("\x1b[") + std::to_string(this->fg)) +
-		(this->bg ? std::string(";") + std::to_string(this->bg) : "")) + 'm') +
-		this->character) + "\x1b[0m");
+	/* Nothing of its own to bound; the mesh's bounds are already there */
+	this->bounds_dirty = 0;
+	this->changed = 1;
+	this->cull_backfaces = mesh->cull_backfaces;
+	this->override_style = 0;
 }
 
-/*
- * Need to specify that local variables line, fill should be created with
- * auto-generated copy constructors, apparently
- */
-Triangle::Triangle(std::vector<double> v[3], Render_symbol line,
-		Render_symbol fill) : line_symbol(line), fill_symbol(fill)
+Shared_mesh Render_object::share(Render_object &&obj)
 {
-	/* Copy v into list of vertices.*/
-	for (int i = 0; i < 3; ++i) {
-		this->vertices[i] = std::vector<double>(v[i]);
-	}
+	/* An instance of an instance is just another instance of its mesh */
+	if (obj.mesh)
+		return obj.mesh;
+	if (obj.bounds_dirty || !obj.bvh.built())
+		obj.update_bounds();
+	return std::make_shared<const Render_object>(std::move(obj));
+}
 
+Aabb Render_object::world_bounds() const
+{
+	const Aabb &b = this->geometry().bvh.bounds();
+	return this->transform.is_identity() ? b : b.transformed(this->transform);
 }
 
-Render_object::Render_object()
+unsigned Render_object::add_vertex(Vec3 v)
 {
-	this->triangles = std::vector<Triangle>();
+	this->bounds_dirty = 1;
+	this->changed = 1;
+	this->vertices.push_back(v);
+	return (unsigned) this->vertices.size() - 1;
 }
 
-void Render_object::add_triangle(std::vector<double> verts[3], char line_c,
+void Render_object::add_triangle(unsigned a, unsigned b, unsigned c,
+		char line_c, enum fg_colour line_fg, enum bg_colour line_bg,
+		char fill_c, enum fg_colour fill_fg, enum bg_colour fill_bg)
+{
+	this->bounds_dirty = 1;
+	this->changed = 1;
+	this->indices.push_back(a);
+	this->indices.push_back(b);
+	this->indices.push_back(c);
+	Triangle_style style = {Render_symbol(line_c, line_fg, line_bg),
+		Render_symbol(fill_c, fill_fg, fill_bg)};
+	this->styles.push_back(style);
+}
+
+void Render_object::add_triangle(Vec3 verts[3], char line_c,
 		enum fg_colour line_fg, enum bg_colour line_bg,
 		char fill_c, enum fg_colour fill_fg,
 		enum bg_colour fill_bg)
 {
-	Render_symbol sym_line(line_c, line_fg, line_bg);
-	Render_symbol sym_fill(fill_c, fill_fg, fill_bg);
-	this->triangles.emplace_back(Triangle(verts, sym_line, sym_fill));
+	unsigned a = this->add_vertex(verts[0]);
+	unsigned b = this->add_vertex(verts[1]);
+	unsigned c = this->add_vertex(verts[2]);
+	this->add_triangle(a, b, c, line_c, line_fg, line_bg, fill_c, fill_fg,
+			fill_bg);
+}
+
+void Render_object::update_bounds()
+{
+	if (!this->mesh)
+		this->bvh.build(this->vertices, this->indices);
+	this->bounds_dirty = 0;
+}
+
+int raster_format_from_name(const char *name)
+{
+	Raster_format all[3] = {raster_double, raster_float, raster_fixed};
+	for (int i = 0; i < 3; ++i) {
+		if (!strcmp(name, raster_format_name(all[i])))
+			return all[i];
+	}
+	return -1;
+}
+
+const char *raster_format_name(Raster_format f)
+{
+	switch (f) {
+		case raster_float:
+			return "float";
+		case raster_fixed:
+			return "fixed";
+		default:
+			return "double";
+	}
 }
 
-Renderer::Renderer(int scr_y, int scr_x, double c_d, int max_objects)
-	: camera_pos(3, 0)
+Renderer::Renderer(int scr_y, int scr_x, double c_d, int objects_hint,
+		int n_workers, Raster_format format)
+	: objects(objects_hint), camera_pos(0, 0, 0), raster_format(format)
 {
-	this->max_objects = max_objects;
-	this->n_objects = 0;
-	this->render_objects = (Render_object *) calloc(max_objects,
-			sizeof(Render_object));
+	switch (format) {
+		case raster_float:
+			this->raster.reset(new Raster_state<Float_raster>(scr_y, scr_x));
+			break;
+		case raster_fixed:
+			this->raster.reset(new Raster_state<Fixed_raster>(scr_y, scr_x));
+			break;
+		default:
+			this->raster_format = raster_double;
+			this->raster.reset(new Raster_state<Double_raster>(scr_y, scr_x));
+			break;
+	}
 
 	this->camera_xangle = 0.0;
 	this->camera_zangle = 0.0;
+	this->camera_seen = this->camera_box.version();
 	this->screen_x = scr_x;
 	this->screen_y = scr_y;
 	this->camera_depth = c_d;
 
 	this->updated = 1;
+	this->redraw_all = 1;
+	this->scan_directly = 0;
+	this->profiler = 0;
 
-	this->screen = (Render_symbol **) calloc(sizeof(Render_symbol *), scr_y);
-	for(int i = 0; i < scr_y; ++i)
-		screen[i] = (Render_symbol *) calloc(sizeof(Render_symbol), scr_x);
+	this->setup_tiles();
+	if (n_workers > 1)
+		this->workers.reset(new Worker_pool(n_workers - 1));
+}
 
+void Renderer::setup_tiles()
+{
+	this->tiles_x = (screen_x + tile_w - 1) / tile_w;
+	this->tiles_y = (screen_y + tile_h - 1) / tile_h;
+	size_t n_tiles = (size_t) tiles_x * tiles_y;
+	/*
+	 * Even on one thread, as that's how parts of the screen get redrawn.
+	 * Bins that are still there keep their capacity.
+	 */
+	resize_reserved(&this->tile_bins, n_tiles);
+	resize_reserved(&this->tile_stats, n_tiles);
+	resize_reserved(&this->tile_damage, n_tiles);
+	std::fill(this->tile_damage.begin(), this->tile_damage.end(), 0);
+}
+
+void Renderer::resize(int scr_y, int scr_x)
+{
+	if (scr_y == this->screen_y && scr_x == this->screen_x)
+		return;
+	this->raster->resize(scr_y, scr_x);
+	this->screen_x = scr_x;
+	this->screen_y = scr_y;
+	this->setup_tiles();
+	/* Where objects were drawn means nothing on a different screen */
+	this->redraw_all = 1;
+}
+
+Object_handle Renderer::add_object(const Render_object &obj)
+{
+	return this->objects.add(obj);
+}
+
+Object_handle Renderer::add_object(Render_object &&obj)
+{
+	return this->objects.add(std::move(obj));
 }
 
-Render_object *Renderer::add_object(Render_object obj)
+int Renderer::remove_object(Object_handle h)
 {
-	/* Returns 0 on failure */
-	if (this->n_objects - this->max_objects) {
-		int n = this->n_objects;
-		this->render_objects[n_objects++] = obj;
-		return &(render_objects[n]);
+	Render_object *obj = this->objects.get(h);
+	if (obj)
+		this->damage(obj->drawn);
+	return this->objects.remove(h);
+}
+
+/* Distances in double, for formats that don't keep them that way */
+template <typename F>
+static Depth_span convert_depth(Raster_state<F> *rs)
+{
+	Grid_span<const typename F::depth> d = rs->screen.depth_span();
+	rs->depth_copy.resize((size_t) d.width * d.height);
+	for (int y = 0; y < d.height; ++y)
+		for (int x = 0; x < d.width; ++x)
+			rs->depth_copy[(size_t) y * d.width + x] = F::from_depth(d[y][x]);
+	Depth_span s = {rs->depth_copy.data(), d.width, d.height};
+	return s;
+}
+
+/*
+ * Each format's code is the same apart from the types (see raster.hh), so
+ * the choice is made once here, rather than per triangle
+ */
+Screen_span Renderer::render()
+{
+	switch (this->raster_format) {
+		case raster_float:
+			return this->render_frame<Float_raster>();
+		case raster_fixed:
+			return this->render_frame<Fixed_raster>();
+		default:
+			return this->render_frame<Double_raster>();
 	}
-	return 0;
+}
 
+Depth_span Renderer::depth()
+{
+	switch (this->raster_format) {
+		case raster_float:
+			return convert_depth(&this->raster_state<Float_raster>());
+		case raster_fixed:
+			return convert_depth(&this->raster_state<Fixed_raster>());
+		default:
+			return this->raster_state<Double_raster>().screen.depth_span();
+	}
 }
 
-/* The return value of this function should not be modified. */
-/* used to be *** */
-Render_symbol **Renderer::render()
+template <typename F>
+Screen_span Renderer::render_frame()
 {
-	/* First, clear screen */
-	for (int i = 0; i < this->screen_y; ++i) {
-		for (int j = 0; j < this->screen_x; ++j) {
-			this->screen[i][j] = Render_symbol(' ', fg_none, bg_none);
+	Raster_state<F> &rs = this->raster_state<F>();
+	this->stats = Render_stats();
+	this->begin_frame();
+
+	/* If the camera has moved, everything has */
+	Camera &last = this->last_camera;
+	if (this->camera_pos.x != last.pos.x || this->camera_pos.y != last.pos.y ||
+			this->camera_pos.z != last.pos.z ||
+			this->camera_xangle != last.xangle ||
+			this->camera_zangle != last.zangle)
+		this->redraw_all = 1;
+	last.pos = this->camera_pos;
+	last.xangle = this->camera_xangle;
+	last.zangle = this->camera_zangle;
+
+	int n_tiles = tiles_x * tiles_y;
+	int all = this->redraw_all;
+	this->scan_directly = 0;
+	{
+		Profile_scope p(this->profiler, stage_clear);
+		if (all) {
+			rs.screen.clear();
+			this->tile_damage.assign(n_tiles, 1);
+		} else {
+			this->find_damage<F>();
+		}
+	}
+	this->damaged_tiles.clear();
+	for (int i = 0; i < n_tiles; ++i)
+		if (this->tile_damage[i])
+			this->damaged_tiles.push_back(i);
+	if (this->damaged_tiles.empty()) {
+		/* Last frame is still right */
+		this->updated = 0;
+		return rs.screen.symbol_span();
+	}
+
+	rs.frame_tris.clear();
+	{
+		Profile_scope p(this->profiler, stage_clear);
+		for (size_t i = 0; i < this->damaged_tiles.size(); ++i) {
+			int t = this->damaged_tiles[i];
+			this->tile_bins[t].clear();
+			if (!all) {
+				int y0 = (t / tiles_x) * tile_h;
+				int x0 = (t % tiles_x) * tile_w;
+				rs.screen.clear_rect(y0, std::min(y0 + tile_h, screen_y) - 1,
+						x0, std::min(x0 + tile_w, screen_x) - 1);
+			}
 		}
 	}
+	/*
+	 * Drawing everything on one thread can go straight to the screen rather
+	 * than through the tiles
+	 */
+	this->scan_directly = all && !this->workers;
 
 	/* Iterate through objects and draw them */
-	Render_object *render_objs = this->render_objects;
+	Render_object *render_objs = this->objects.begin();
 	/* Not calling size every iteration of a loop is probably good */
-	int n_objs = this->n_objects;
+	int n_objs = (int) this->objects.size();
+	size_t terms = 0;
+	Raster_triangle_t<F> rt;
+	/* Setting up (and scanning, or binning) triangles; culling is nested */
+	{
+		Profile_scope p(this->profiler, stage_raster);
+		for (int i = 0; i < n_objs; ++i) {
+			Render_object *obj = &render_objs[i];
+			obj->changed = 0;
+			/* Nowhere near anything being redrawn */
+			if (!all && !this->damaged(obj->drawn))
+				continue;
+			size_t n_tria = obj->n_triangles();
+			this->stats.triangles_submitted += n_tria;
+			const uint64_t *mask;
+			if (!this->prepare_object<F>(obj, &mask))
+				continue;
+			for(size_t j = 0; j < n_tria; ++j) {
+				if (mask && !((mask[j >> 6] >> (j & 63)) & 1))
+					continue;
+				if (!this->setup_triangle<F>(obj, j, &rt, terms))
+					continue;
+				obj->drawn.grow(this->cells(rt));
+				if (this->scan_directly) {
+					this->scan_triangle<F>(&rt, 0, screen_y - 1, 0,
+							screen_x - 1, &this->stats);
+					++this->stats.triangles_drawn;
+				} else if (this->bin_triangle(rt)) {
+					terms += (rt.y1 - rt.y0 + 3) + (rt.x1 - rt.x0 + 3);
+					++this->stats.triangles_drawn;
+				}
+			}
+		}
+
+	}
+	int n_damaged = (int) this->damaged_tiles.size();
+	if (!this->scan_directly) {
+		Profile_scope p(this->profiler, stage_raster);
+		if (this->workers) {
+			this->workers->run(raster_tile_job<F>, this, n_damaged);
+		} else {
+			for (int i = 0; i < n_damaged; ++i)
+				this->raster_tile<F>(this->damaged_tiles[i]);
+		}
+		for (int i = 0; i < n_damaged; ++i) {
+			const Render_stats &ts = this->tile_stats[this->damaged_tiles[i]];
+			this->stats.triangles_occluded += ts.triangles_occluded;
+			this->stats.occluded_cells_saved += ts.occluded_cells_saved;
+			this->stats.cells_tested += ts.cells_tested;
+			this->stats.depth_rejects += ts.depth_rejects;
+		}
+	}
+	this->stats.tiles_drawn = n_damaged;
+
+	for (int i = 0; i < n_damaged; ++i)
+		this->tile_damage[this->damaged_tiles[i]] = 0;
+	this->redraw_all = 0;
+	this->updated = 1;
+	return rs.screen.symbol_span();
+}
+
+/*
+ * Damages wherever changed objects were and wherever they are now. The
+ * latter is usually just the screen extent of the object's bounding box,
+ * which is more than it covers, but cheap; where that isn't to be had, its
+ * triangles are set up (and then again when it is drawn) to find out.
+ * Either way, drawing it records exactly where it went.
+ */
+template <typename F>
+void Renderer::find_damage()
+{
+	Render_object *render_objs = this->objects.begin();
+	int n_objs = (int) this->objects.size();
+	Raster_triangle_t<F> rt;
 	for (int i = 0; i < n_objs; ++i) {
-		std::vector<Triangle> triangles = render_objs[i].triangles;
-		size_t n_tria = triangles.size();
-		for(size_t j = 0; j < n_tria; ++j) {
-			this->draw_triangle(&triangles[j]);
+		Render_object *obj = &render_objs[i];
+		if (!obj->changed && !obj->bounds_dirty)
+			continue;
+		this->damage(obj->drawn);
+		if (obj->bounds_dirty)
+			obj->update_bounds();
+		Aabb bounds = obj->world_bounds();
+		if (this->frustum.test(bounds) == Frustum::outside) {
+			obj->drawn = Screen_rect();
+			continue;
+		}
+		Screen_rect extent;
+		if (this->screen_extent(bounds, &extent)) {
+			/* Drawing it will make this exact */
+			obj->drawn = extent;
+			this->damage(extent);
+			continue;
+		}
+		const uint64_t *mask;
+		if (!this->prepare_object<F>(obj, &mask))
+			continue;
+		size_t n_tria = obj->n_triangles();
+		for (size_t j = 0; j < n_tria; ++j) {
+			if (mask && !((mask[j >> 6] >> (j & 63)) & 1))
+				continue;
+			if (this->setup_triangle<F>(obj, j, &rt, 0))
+				obj->drawn.grow(this->cells(rt));
 		}
+		this->damage(obj->drawn);
 	}
-	this->updated = 0;
-	/* used to be &(...) */
-	return (this->screen);
+	/* None of that was drawing, so doesn't count */
+	this->stats = Render_stats();
 }
 
-void Renderer::draw_triangle(Triangle *t)
+void Renderer::damage(const Screen_rect &r)
 {
+	if (r.empty())
+		return;
+	for (int ty = r.y0 / tile_h; ty <= r.y1 / tile_h; ++ty)
+		for (int tx = r.x0 / tile_w; tx <= r.x1 / tile_w; ++tx)
+			this->tile_damage[ty * tiles_x + tx] = 1;
+}
+
+int Renderer::damaged(const Screen_rect &r) const
+{
+	if (r.empty())
+		return 0;
+	for (int ty = r.y0 / tile_h; ty <= r.y1 / tile_h; ++ty)
+		for (int tx = r.x0 / tile_w; tx <= r.x1 / tile_w; ++tx)
+			if (this->tile_damage[ty * tiles_x + tx])
+				return 1;
+	return 0;
+}
+
+template <typename F>
+Screen_rect Renderer::cells(const Raster_triangle_t<F> &rt) const
+{
+	return Screen_rect(screen_y/2 - 1 - rt.y1, screen_y/2 - 1 - rt.y0,
+			rt.x0 + screen_x/2, rt.x1 + screen_x/2);
+}
+
+void Renderer::begin_frame()
+{
+	if (this->camera_box.version() != this->camera_seen) {
+		Camera c;
+		this->camera_seen = this->camera_box.load(&c);
+		this->camera_pos = c.pos;
+		this->camera_xangle = c.xangle;
+		this->camera_zangle = c.zangle;
+	}
+
+	double cx = this->camera_xangle;
+	double cz = this->camera_zangle;
+	this->basis.origin = this->camera_pos;
+	this->basis.right = Vec3(cos(cx), sin(cx), 0);
+	this->basis.up = Vec3(sin(-cz)*sin(cx), sin(cz)*cos(cx), cos(cz));
+	this->basis.forward = vec_cross(this->basis.up, this->basis.right);
+	this->basis.depth = this->camera_depth;
+
+	double scr_x_c = this->screen_x / 5.0;
+	double scr_y_c = scr_x_c / (15.0/8.0);
+	this->frustum.set(this->basis, screen_x, screen_y, scr_x_c, scr_y_c);
+}
+
+template <typename F>
+int Renderer::prepare_object(Render_object *obj, const uint64_t **mask)
+{
+	if (obj->bounds_dirty)
+		obj->update_bounds();
+
+	const Render_object &g = obj->geometry();
+	const Transform &t = obj->transform;
+	int moved = !t.is_identity();
+	Aabb bounds = moved ? g.bvh.bounds().transformed(t) : g.bvh.bounds();
+	size_t n_tria = g.n_triangles();
+	*mask = 0;
+	obj->drawn = Screen_rect();
+	/*
+	 * Testing the whole box is cheaper than timing it would be, so only
+	 * the culling that goes any further counts as culling
+	 */
+	switch (this->frustum.test(bounds)) {
+		case Frustum::outside:
+			++this->stats.objects_culled;
+			this->stats.triangles_culled += n_tria;
+			return 0;
+		case Frustum::inside:
+			break;
+		case Frustum::intersecting: {
+			/* Only partly on screen: find out which bits */
+			Profile_scope cull(this->profiler, stage_cull);
+			this->tri_mask.assign((n_tria + 63) / 64, 0);
+			/* The mesh's own bounds, against the frustum where they are */
+			this->stats.triangles_culled += g.bvh.mark_visible(moved ?
+					this->frustum.to_model(t) : this->frustum,
+					this->tri_mask.data());
+			*mask = this->tri_mask.data();
+			break;
+		}
+	}
+
+	/*
+	 * When the screen is drawn as we go, whole objects behind what is
+	 * already there can be skipped too. There's no telling where it would
+	 * have been drawn then, so as far as redrawing goes it's everywhere.
+	 */
+	if (this->scan_directly) {
+		Profile_scope cull(this->profiler, stage_cull);
+		if (this->object_occluded<F>(bounds)) {
+			++this->stats.objects_occluded;
+			this->stats.triangles_occluded += n_tria;
+			obj->drawn = Screen_rect(0, screen_y - 1, 0, screen_x - 1);
+			return 0;
+		}
+	}
+
+	/* Every vertex only needs projecting once, however many triangles use it */
+	Profile_scope project(this->profiler, stage_project);
+	const Vertex_buffer &v = g.vertices;
+	Projected_vertices_t<typename F::coord> &out =
+		this->raster_state<F>().projected;
+	out.reserve(v.size());
+	if (!moved) {
+		project_vertices(this->basis, v.xs.data(), v.ys.data(), v.zs.data(),
+				v.size(), out.a.data(), out.b.data(), out.dist.data(),
+				out.visible.data());
+		return 1;
+	}
+
+	/*
+	 * Rather than moving every vertex, move the camera into the model's
+	 * coordinates: with its axes turned the same way, what it sees is the
+	 * same, apart from distances being 1/scale as big
+	 */
+	Camera_basis local = this->basis;
+	local.origin = t.to_model(this->basis.origin);
+	local.right = t.to_model_dir(this->basis.right);
+	local.up = t.to_model_dir(this->basis.up);
+	local.forward = t.to_model_dir(this->basis.forward);
+	project_vertices(local, v.xs.data(), v.ys.data(), v.zs.data(), v.size(),
+			out.a.data(), out.b.data(), out.dist.data(), out.visible.data());
+	if (t.scale != 1.0) {
+		typename F::coord s2 = t.scale * t.scale;
+		for (size_t i = 0; i < v.size(); ++i)
+			out.dist[i] *= s2;
+	}
+	return 1;
+}
+
+/*
+ * Drawing in tiles: set up every triangle first, sort them into the
+ * damaged screen tiles they touch, then draw a tile at a time (with workers,
+ * a tile each).
+ * Each tile only ever touches its own cells, so nothing needs locking, and
+ * within a tile triangles are drawn in the same order as they would be on
+ * one thread, so the result is identical. The same goes for redrawing only
+ * some of the tiles: what's in a tile depends only on the triangles touching
+ * it.
+ */
+template <typename F>
+int Renderer::bin_triangle(const Raster_triangle_t<F> &rt)
+{
+	std::vector<Raster_triangle_t<F> > &frame_tris =
+		this->raster_state<F>().frame_tris;
+	int n = (int) frame_tris.size();
+	int binned = 0;
+
+	Screen_rect c = this->cells(rt);
+	for (int ty = c.y0 / tile_h; ty <= c.y1 / tile_h; ++ty) {
+		for (int tx = c.x0 / tile_w; tx <= c.x1 / tile_w; ++tx) {
+			int t = ty * tiles_x + tx;
+			if (!this->tile_damage[t])
+				continue;
+			this->tile_bins[t].push_back(n);
+			binned = 1;
+		}
+	}
+	if (binned)
+		frame_tris.push_back(rt);
+	return binned;
+}
+
+template <typename F>
+void Renderer::raster_tile_job(void *renderer, int i)
+{
+	Renderer *r = (Renderer *) renderer;
+	r->raster_tile<F>(r->damaged_tiles[i]);
+}
+
+template <typename F>
+void Renderer::raster_tile(int tile)
+{
+	const std::vector<Raster_triangle_t<F> > &frame_tris =
+		this->raster_state<F>().frame_tris;
+	int sy0 = (tile / tiles_x) * tile_h;
+	int sx0 = (tile % tiles_x) * tile_w;
+	int sy1 = std::min(sy0 + tile_h, screen_y) - 1;
+	int sx1 = std::min(sx0 + tile_w, screen_x) - 1;
+	const std::vector<int> &bin = this->tile_bins[tile];
+	Render_stats *stats = &this->tile_stats[tile];
+	*stats = Render_stats();
+	for (size_t i = 0; i < bin.size(); ++i)
+		this->scan_triangle<F>(&frame_tris[bin[i]], sy0, sy1, sx0, sx1,
+				stats);
+}
+
+/*
+ * Cells that anything inside bounding box b can be drawn in, going by its
+ * corners. Returns 0 if that can't be told this way, as not all of it is in
+ * front of the camera (or there's nothing in it).
+ */
+int Renderer::screen_extent(const Aabb &b, Screen_rect *r) const
+{
+	if (b.empty())
+		return 0;
+
+	/*
+	 * Project the box's corners to find its extent on screen; its contents
+	 * project inside that as long as all of it is in front of the camera
+	 */
+	double scr_x_c = this->screen_x / 5.0;
+	double scr_y_c = scr_x_c / (15.0/8.0);
+	double ymin = INFINITY, ymax = -INFINITY, xmin = INFINITY, xmax = -INFINITY;
+	for (int i = 0; i < 8; ++i) {
+		Vec3 P((i & 1) ? b.hi.x : b.lo.x, (i & 2) ? b.hi.y : b.lo.y,
+				(i & 4) ? b.hi.z : b.lo.z);
+		Vec3 A = vec_sub(P, this->basis.origin);
+		double q = vec_dot(A, this->basis.forward);
+		if (!(q > 0))
+			return 0;
+		double l = this->basis.depth / q;
+		double y = vec_dot(A, this->basis.up) * l * scr_y_c;
+		double x = vec_dot(A, this->basis.right) * l * scr_x_c;
+		ymin = std::min(ymin, y);
+		ymax = std::max(ymax, y);
+		xmin = std::min(xmin, x);
+		xmax = std::max(xmax, x);
+	}
+	/* A cell of margin, then clip to the screen (in array coordinates) */
+	double ay0 = std::max(0.0, screen_y/2 - 1 - ceil(ymax) - 1);
+	double ay1 = std::min(screen_y - 1.0, screen_y/2 - 1 - floor(ymin) + 1);
+	double ax0 = std::max(0.0, floor(xmin) + screen_x/2 - 1);
+	double ax1 = std::min(screen_x - 1.0, ceil(xmax) + screen_x/2 + 1);
+	/* Off screen */
+	*r = Screen_rect();
+	if (ay0 <= ay1 && ax0 <= ax1)
+		*r = Screen_rect((int) ay0, (int) ay1, (int) ax0, (int) ax1);
+	return 1;
+}
+
+/*
+ * Whether an object with bounding box b is entirely behind what has been
+ * drawn so far
+ */
+template <typename F>
+int Renderer::object_occluded(const Aabb &b)
+{
+	Screen_rect r;
+	if (!this->screen_extent(b, &r) || r.empty())
+		return 0;
+
+	/*
+	 * Nothing in the box is nearer than its nearest point. How much
+	 * rounding can take off that depends on the format, and for some on
+	 * how far away the rest of it is, which is at most its farthest point.
+	 */
+	Vec3 C0 = this->basis.origin;
+	Vec3 near(std::min(std::max(C0.x, b.lo.x), b.hi.x),
+			std::min(std::max(C0.y, b.lo.y), b.hi.y),
+			std::min(std::max(C0.z, b.lo.z), b.hi.z));
+	Vec3 far(fabs(b.lo.x - C0.x) > fabs(b.hi.x - C0.x) ? b.lo.x : b.hi.x,
+			fabs(b.lo.y - C0.y) > fabs(b.hi.y - C0.y) ? b.lo.y : b.hi.y,
+			fabs(b.lo.z - C0.z) > fabs(b.hi.z - C0.z) ? b.lo.z : b.hi.z);
+	Vec3 A = vec_sub(near, C0);
+	Vec3 B = vec_sub(far, C0);
+	double nearest = F::depth_units(vec_dot(A, A));
+	double farthest = F::depth_units(vec_dot(B, B));
+	return this->occluded<F>(r.y0, r.y1, r.x0, r.x1,
+			nearest - F::object_slack(nearest, farthest));
+}
+
+template <typename F>
+int Renderer::occluded(int y0, int y1, int x0, int x1, double nearest)
+{
+	Framebuffer<typename F::depth> &screen = this->raster_state<F>().screen;
+	int hw = screen.hiz_w;
+	int hh = screen.hiz_h;
+	for (int ty = y0 / hh; ty <= y1 / hh; ++ty) {
+		for (int tx = x0 / hw; tx <= x1 / hw; ++tx) {
+			/* Cells at that distance already win the depth test */
+			if (!(screen.tile_max_depth(ty, tx) <= nearest))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+template <typename F>
+int Renderer::setup_triangle(const Render_object *obj, size_t tri,
+		Raster_triangle_t<F> *rt, size_t terms)
+{
+	/*
+	 * Everything up to the terms is done in F's coordinate type; with
+	 * double, this is exactly what was always done
+	 */
+	typedef typename F::coord C;
+	typedef typename F::term T;
+	typedef typename F::depth D;
+	Raster_state<F> &rs = this->raster_state<F>();
+
 	/*
 	 * 1: find on-screen coordinates and distances from screen of triangle
-	 * vertices
+	 * vertices (already worked out by project_vertices())
 	 */
 
-	std::vector<double> *scs = this->screen_project(t);
-	if (!scs)
-		return;
+	Vec3_t<C> scs[3];
+	const Render_object &g = obj->geometry();
+	const unsigned *idx = &g.indices[3 * tri];
+	const Projected_vertices_t<C> &pv = rs.projected;
+	for (int i = 0; i < 3; ++i) {
+		size_t v = idx[i];
+		if (!pv.visible[v])
+			return 0;
+		scs[i] = Vec3_t<C>(pv.a[v], pv.b[v], pv.dist[v]);
+	}
 
 	/* Triangles are thin and cannot be seen side-on */
 	for (int i = 0; i < 3; ++i) {
 		for (int j = i+1; j <3; ++j) {
 			if ((scs[i][0] - scs[j][0]) || (scs[i][1] - scs[j][1]))
 				continue;
-			return;
+			return 0;
 		}
 	}
 
@@ -152,9 +731,9 @@ void Renderer::draw_triangle(Triangle *t)
 	 * screen_x/2.5 (for x) (5 unit wide camera plane) or (8/15)*screen_x/(2.5)
 	 * (for y)
 	 */
-	double ys = 15.0/8.0;
-	double scr_x_c = this->screen_x / 5.0;
-	double scr_y_c = scr_x_c / ys;
+	C ys = C(15.0/8.0);
+	C scr_x_c = this->screen_x / C(5.0);
+	C scr_y_c = scr_x_c / ys;
 
 	for (int i = 0; i < 3; ++i) {
 		scs[i][1] *= scr_x_c;
@@ -162,127 +741,199 @@ void Renderer::draw_triangle(Triangle *t)
 	}
 
 
-	double ymin = floor(std::min(scs[0][0], std::min(scs[1][0], scs[2][0])));
-	double ymax = ceil(std::max(scs[0][0], std::max(scs[1][0], scs[2][0])));
-	double xmin = floor(std::min(scs[0][1], std::min(scs[1][1], scs[2][1])));
-	double xmax = ceil(std::max(scs[0][1], std::max(scs[1][1], scs[2][1])));
-
-	/* Use convex combination trickery to shade triangle only */
-	double dist0 = scs[0][2];
-	double dc1 = scs[1][2] - dist0;
-	double dc2 = scs[2][2] - dist0;
-
-	std::vector<double> r0({scs[0][0], scs[0][1]});
-
-	std::vector<double> u1 = vec_sub(scs[1], scs[0]);
-	u1.pop_back();
-	std::vector<double> u2 = vec_sub(scs[2], scs[0]);
-	u2.pop_back();
-
-
-	/* Features corrections to avoid drawing off-screen */
-	for (int y = (int) std::max(-1.0*screen_y/2, floor(ymin));
-			y <= std::min(1.0*screen_y/2 - 1.0, ceil(ymax)); ++y) {
+	C ymin = std::floor(std::min(scs[0][0], std::min(scs[1][0], scs[2][0])));
+	C ymax = std::ceil(std::max(scs[0][0], std::max(scs[1][0], scs[2][0])));
+	C xmin = std::floor(std::min(scs[0][1], std::min(scs[1][1], scs[2][1])));
+	C xmax = std::ceil(std::max(scs[0][1], std::max(scs[1][1], scs[2][1])));
 
-		for (int x = (int) std::max(-1.0*screen_x/2, floor(xmin));
-				x <= std::min(1.0*screen_x/2 - 1.0, ceil(xmax)); ++x) {
-
-			/* Map coordinates to array indices */
-			int yp = screen_y/2 - 1 - y;
-			int xp = x + screen_x/2;
-			double dist = this->dist_calc(r0, u1, u2, dist0, dc1, dc2, y, x);
-			/* Nearer things cover farther ones */
-			if (dist >= screen[yp][xp].distance) {
-				continue;
-			}
-			if (this->is_inside(r0, u1, u2, y, x)) {
-				/* Check if this is at the edge of a triangle */
-				int edge = 0;
-				for (int p = -1; p <= 1 && !edge; p+=2) {
-					for (int q = -1; q <=1 && !edge; q+=2) {
-						if (!(this->is_inside(r0, u1, u2, y+p, x+q))) {
-							this->screen[yp][xp] = Render_symbol(t->line_symbol);
-							this->screen[yp][xp].distance = dist;
-							edge = 1;
-						}
-					}
-				}
-				if (edge)
-					continue;
-				/* If this isn't the edge of a triangle, draw accordingly */
-				this->screen[yp][xp] = Render_symbol(t->fill_symbol);
-				this->screen[yp][xp].distance = dist;
-			}
-		}
-	}
-}
-std::vector<double> *Renderer::screen_project(Triangle *t)
-{
 	/*
-	 * Return value is pointer to static variable to avoid repeated allocations;
-	 * don't need result of using this on two triangles at the same time, so
-	 * no problem. Returns 0 if line from a vertex to camera never intersects
-	 * camera plane; that's not a problem as in that case, the triangle is
-	 * either behind the plane or intersects the camera; either way, this is
-	 * not normal.
+	 * Features corrections to avoid drawing off-screen. Clamping happens in
+	 * floating point before converting, so vertices far off to the side
+	 * can't overflow an int.
 	 */
+	C y_lo = std::max(C(-1.0*screen_y/2), ymin);
+	C y_hi = std::floor(std::min(C(1.0*screen_y/2 - 1.0), ymax));
+	C x_lo = std::max(C(-1.0*screen_x/2), xmin);
+	C x_hi = std::floor(std::min(C(1.0*screen_x/2 - 1.0), xmax));
+	if (!(y_lo <= y_hi) || !(x_lo <= x_hi))
+		return 0;
+	rt->y0 = (int) y_lo;
+	rt->y1 = (int) y_hi;
+	rt->x0 = (int) x_lo;
+	rt->x1 = (int) x_hi;
 
-	/* Components: screen x coordinate, screen y coordinate, distance from scr */
-	static std::vector<double> ret[3];
-	
-	double d = this->camera_depth;
-	double cx = this->camera_xangle;
-	double cz = this->camera_zangle;
-	double a, b, l, q;
-	std::vector<double> C0 = this->camera_pos;
-	std::vector<double> Cr({cos(cx), sin(cx), 0});
-	std::vector<double> Cu({sin(-cz)*sin(cx), sin(cz)*cos(cx), cos(cz)});
-	std::vector<double> Cf = vec_cross(Cu, Cr);
+	/*
+	 * Anticlockwise on screen (x right, y up) is the front. Exactly
+	 * side-on triangles are left for the rasteriser to deal with.
+	 */
+	if (obj->cull_backfaces) {
+		C winding = (scs[1][1] - scs[0][1]) * (scs[2][0] - scs[0][0]) -
+			(scs[1][0] - scs[0][0]) * (scs[2][1] - scs[0][1]);
+		if (winding < 0) {
+			++this->stats.backfaces_culled;
+			this->stats.backface_cells_saved +=
+				(size_t) (rt->y1 - rt->y0 + 1) * (rt->x1 - rt->x0 + 1);
+			return 0;
+		}
+	}
 
-	for (int i = 0; i < 3; ++i) {
-		/* I worked this out on paper; explaining it in comments would be a pain */
-		std::vector<double> P = t->vertices[i];
-		std::vector<double> A = vec_sub(P, C0);
-		q = vec_dot(A, Cf);
+	rt->style = obj->override_style ? &obj->style : &g.styles[tri];
+	/* Map coordinates to array indices */
+	Screen_rect c = this->cells(*rt);
+	rs.screen.touch(c.y0, c.y1, c.x0, c.x1);
 
-		if (!q or (vec_dot(Cf, A) < 0))
-			return 0;
+	/* Use convex combination trickery to shade triangle only */
+	D d[3];
+	for (int i = 0; i < 3; ++i)
+		d[i] = F::to_depth(scs[i][2]);
+	rt->dist0 = d[0];
+	rt->dc1 = d[1] - rt->dist0;
+	rt->dc2 = d[2] - rt->dist0;
+	/*
+	 * Distances are interpolated, so cells inside the triangle are no
+	 * nearer than its nearest vertex, give or take rounding
+	 */
+	rt->nearest = (double) std::min(d[0], std::min(d[1], d[2])) -
+		F::slack(fabs((double) rt->dist0) + fabs((double) rt->dc1) +
+				fabs((double) rt->dc2));
 
-		l = d/q;
-		b = vec_dot(A, Cr) * l;
-		a = vec_dot(A, Cu) * l;
+	Vec2_t<C> r0 = scs[0].xy();
 
-		ret[i] = std::vector<double>({a, b, vec_dot(vec_sub(C0, P),
-					vec_sub(C0, P))});
-	}
-	return ret;
-}
+	Vec2_t<C> u1 = vec_sub(scs[1], scs[0]).xy();
+	Vec2_t<C> u2 = vec_sub(scs[2], scs[0]).xy();
 
-int Renderer::is_inside(std::vector<double> r0, std::vector<double> u1,
-		std::vector<double> u2, int y, int x)
-{
 	/*
-	 * These are guaranteed to exist because we earlier eliminated the case 
+	 * These are guaranteed to exist because we earlier eliminated the case
 	 * where any of scs[0] [1] or [2] have equal [0] and [1] components
 	 */
-	std::vector<double> v1 = vec_recip2(u1, u2);
-	std::vector<double> v2 = vec_recip2(u2, u1);
+	Vec2_t<C> v1 = vec_recip2(u1, u2);
+	Vec2_t<C> v2 = vec_recip2(u2, u1);
 
-	std::vector<double> r = vec_sub(std::vector<double>({y*1.0, x*1.0}),
-			r0);
-	double c1 = vec_dot(r, v1);
-	double c2 = vec_dot(r, v2);
-	return (c1 <= 1.0 && c1 >= 0.0 && c2 <=1.0 && c2 >= 0.0 && (c1 + c2) <= 1.0);
+	/*
+	 * Tabulate the row and column halves of the edge functions. Each entry is
+	 * computed directly rather than by repeatedly adding a step, so there is
+	 * no drift across wide triangles.
+	 */
+	int rows = rt->y1 - rt->y0 + 3;
+	int cols = rt->x1 - rt->x0 + 3;
+	std::vector<Vec2_t<T> > &raster_terms = rs.terms;
+	if (raster_terms.size() < terms + rows + cols)
+		raster_terms.resize(std::max(terms + rows + cols,
+					2 * raster_terms.size()));
+	rt->terms = terms;
+	/* The terms are linear, so the largest are at one end or the other */
+	C ry0 = (rt->y0 - 1)*C(1.0) - r0.x;
+	C ry1 = (rt->y1 + 1)*C(1.0) - r0.x;
+	C rx0 = (rt->x0 - 1)*C(1.0) - r0.y;
+	C rx1 = (rt->x1 + 1)*C(1.0) - r0.y;
+	double largest = std::max(
+			std::max(std::max(fabs(ry0 * v1.x), fabs(ry1 * v1.x)),
+				std::max(fabs(ry0 * v2.x), fabs(ry1 * v2.x))),
+			std::max(std::max(fabs(rx0 * v1.y), fabs(rx1 * v1.y)),
+				std::max(fabs(rx0 * v2.y), fabs(rx1 * v2.y))));
+	int shift = rt->shift = F::term_shift(largest);
+	if (shift < 0)
+		return 0;
+	Vec2_t<T> *row_terms = raster_terms.data() + terms;
+	Vec2_t<T> *col_terms = row_terms + rows;
+	for (int i = 0; i < rows; ++i) {
+		C ry = (rt->y0 - 1 + i)*C(1.0) - r0.x;
+		row_terms[i] = Vec2_t<T>(F::to_term(ry * v1.x, shift),
+				F::to_term(ry * v2.x, shift));
+	}
+	for (int i = 0; i < cols; ++i) {
+		C rx = (rt->x0 - 1 + i)*C(1.0) - r0.y;
+		col_terms[i] = Vec2_t<T>(F::to_term(rx * v1.y, shift),
+				F::to_term(rx * v2.y, shift));
+	}
+	return 1;
 }
 
+/*
+ * Whether barycentric coordinates c lie inside (or on) the triangle, one
+ * being 1 in whatever c is in
+ */
+template <typename T>
+static inline int is_inside(Vec2_t<T> c, T one)
+{
+	return (c.x <= one && c.x >= 0 && c.y <= one && c.y >= 0 &&
+			(c.x + c.y) <= one);
+}
 
-double Renderer::dist_calc(std::vector<double> r0, std::vector<double> u1,
-		std::vector<double> u2, double dist0, double dc1, double dc2,
-		int y, int x)
+template <typename F>
+int Renderer::scan_triangle(const Raster_triangle_t<F> *rt, int sy0, int sy1,
+		int sx0, int sx1, Render_stats *stats)
 {
-	std::vector<double> v1 = vec_recip2(u1, u2);
-	std::vector<double> v2 = vec_recip2(u2, u1);
-	std::vector<double> r = vec_sub(std::vector<double>({y*1.0, x*1.0}), r0);
-	return (dist0 + dc1*vec_dot(r, v1) + dc2*vec_dot(r, v2));
+	typedef typename F::term T;
+	typedef typename F::depth D;
+	Raster_state<F> &rs = this->raster_state<F>();
+	const Render_symbol &line = rt->style->line_symbol;
+	const Render_symbol &fill = rt->style->fill_symbol;
+	/* Index the terms directly by screen coordinates */
+	const Vec2_t<T> *terms = rs.terms.data() + rt->terms;
+	const Vec2_t<T> *rows = terms - (rt->y0 - 1);
+	const Vec2_t<T> *cols = terms + (rt->y1 - rt->y0 + 3) - (rt->x0 - 1);
+	D dist0 = rt->dist0;
+	D dc1 = rt->dc1;
+	D dc2 = rt->dc2;
+	int shift = rt->shift;
+	const T one = F::one(shift);
+
+	/* Clip to the given rectangle, converting it to screen coordinates */
+	int y0 = std::max(rt->y0, screen_y/2 - 1 - sy1);
+	int y1 = std::min(rt->y1, screen_y/2 - 1 - sy0);
+	int x0 = std::max(rt->x0, sx0 - screen_x/2);
+	int x1 = std::min(rt->x1, sx1 - screen_x/2);
+	if (y0 > y1 || x0 > x1)
+		return 1;
+
+	/* Map coordinates to array indices */
+	int ay0 = screen_y/2 - 1 - y1;
+	int ay1 = screen_y/2 - 1 - y0;
+	int ax0 = x0 + screen_x/2;
+	int ax1 = x1 + screen_x/2;
+	if (this->occluded<F>(ay0, ay1, ax0, ax1, rt->nearest)) {
+		++stats->triangles_occluded;
+		stats->occluded_cells_saved += (size_t) (y1 - y0 + 1) * (x1 - x0 + 1);
+		return 0;
+	}
 
+	stats->cells_tested += (size_t) (y1 - y0 + 1) * (x1 - x0 + 1);
+	size_t rejects = 0;
+	int wrote = 0;
+	for (int y = y0; y <= y1; ++y) {
+		Render_symbol *row = rs.screen.row(screen_y/2 - 1 - y);
+		D *depth = rs.screen.depth_row(screen_y/2 - 1 - y);
+		Vec2_t<T> above = rows[y - 1];
+		Vec2_t<T> here = rows[y];
+		Vec2_t<T> below = rows[y + 1];
+
+		for (int x = x0; x <= x1; ++x) {
+			int xp = x + screen_x/2;
+			Vec2_t<T> c = vec_add(here, cols[x]);
+			typename F::dist dist = F::interpolate(dist0, dc1, dc2, c, shift);
+			/* Nearer things cover farther ones */
+			if (dist >= depth[xp]) {
+				++rejects;
+				continue;
+			}
+			if (!is_inside(c, one))
+				continue;
+			/*
+			 * This is at the edge of the triangle if any diagonal neighbour
+			 * is outside it; those only differ by a row and a column term
+			 */
+			int edge = !is_inside(vec_add(above, cols[x - 1]), one) ||
+				!is_inside(vec_add(above, cols[x + 1]), one) ||
+				!is_inside(vec_add(below, cols[x - 1]), one) ||
+				!is_inside(vec_add(below, cols[x + 1]), one);
+			row[xp] = edge ? line : fill;
+			depth[xp] = (D) dist;
+			wrote = 1;
+		}
+	}
+	stats->depth_rejects += rejects;
+	if (wrote)
+		rs.screen.depth_changed(ay0, ay1, ax0, ax1);
+	return 1;
 }
@@ -1,157 +1,405 @@
 #ifndef RENDER_H_I
 #define RENDER_H_I
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
-/* These are the colour codes for ANSI terminal colours */
-enum fg_colour {
-	fg_none = 0,
-	fg_black = 30,
-	fg_red = 31,
-	fg_green = 32,
-	fg_yellow = 33,
-	fg_blue = 34,
-	fg_magenta = 35,
-	fg_cyan = 36,
-	fg_white = 37,
-	/* Bright colours */
-	fg_b_black = 90,
-	fg_b_red = 91,
-	fg_b_green = 92,
-	fg_b_yellow = 93,
-	fg_b_blue = 94,
-	fg_b_magenta = 95,
-	fg_b_cyan = 96,
-	fg_b_white = 97
-};
+#include "bounds.hh"
+#include "camera.hh"
+#include "framebuffer.hh"
+#include "profile.hh"
+#include "project.hh"
+#include "raster.hh"
+#include "slot_map.hh"
+#include "vec_ops.hh"
+#include "workers.hh"
 
-enum bg_colour {
-	bg_none = 0,
-	bg_black = 40,
-	bg_red = 41,
-	bg_green = 42,
-	bg_yellow = 43,
-	bg_blue = 44,
-	bg_magenta = 45,
-	bg_cyan = 46,
-	bg_white = 47,
-	/* Bright colours */
-	bg_b_black = 100,
-	bg_b_red = 101,
-	bg_b_green = 102,
-	bg_b_yellow = 103,
-	bg_b_blue = 104,
-	bg_b_magenta = 105,
-	bg_b_cyan = 106,
-	bg_b_white = 107
+/* What a triangle looks like: symbols for its edges and for its inside */
+struct Triangle_style {
+	Render_symbol line_symbol;
+	Render_symbol fill_symbol;
 };
 
-/* Describes what to draw on the screen when a shape is rendered */
-class Render_symbol {
-	public:
-		Render_symbol(char c, enum fg_colour f,	enum bg_colour b);
-		std::string get_string();
-		/*
-		 * For use in Renderer.render() to check whether to overwrite a symbol
-		 * because it is covered by something nearer
-		 */
-		double distance;
-	private:
-		enum fg_colour fg;
-		enum bg_colour bg;
-		char character;
+/* Rows y0..y1 and columns x0..x1 of the screen, inclusive, in array coordinates */
+struct Screen_rect {
+	int y0, y1, x0, x1;
+
+	Screen_rect() : y0(0), y1(-1), x0(0), x1(-1) {}
+	Screen_rect(int y0, int y1, int x0, int x1)
+		: y0(y0), y1(y1), x0(x0), x1(x1) {}
+	bool empty() const { return y0 > y1 || x0 > x1; }
+	void grow(const Screen_rect &r)
+	{
+		if (r.empty())
+			return;
+		if (this->empty()) {
+			*this = r;
+			return;
+		}
+		this->y0 = std::min(this->y0, r.y0);
+		this->y1 = std::max(this->y1, r.y1);
+		this->x0 = std::min(this->x0, r.x0);
+		this->x1 = std::max(this->x1, r.x1);
+	}
 };
 
+class Render_object;
+
+/* A mesh any number of objects can draw at once; see Render_object */
+typedef std::shared_ptr<const Render_object> Shared_mesh;
+
 /*
- * Triangle would look almost exactly the same as a struct, but I'm trying to
- * write something that looks like C++ and not C.
- * Triangles are used to make 3D shapes for rendering.
+ * Describes a 3D shape, as an indexed mesh: each vertex is stored once
+ * however many triangles share it, and a triangle is three indices into the
+ * vertices. Triangles' symbols are kept apart from their indices, as
+ * projection and setup only need the latter.
+ *
+ * Its vertices are in its own model coordinates, which transform puts in
+ * the world. An object can also be an instance of a shared mesh instead of
+ * having any triangles of its own: then it draws the mesh's, wherever its
+ * transform puts them, so however many instances there are, there's only
+ * one copy of the mesh. Moving one is a matter of changing its transform.
  */
-class Triangle {
-	public:
-		Triangle(std::vector<double> v[3], Render_symbol line, Render_symbol fill);
-		std::vector<double> vertices[3];
-		Render_symbol line_symbol;
-		Render_symbol fill_symbol;
-};
-
-/* Describes a 3D shape */
 class Render_object {
 	public:
 		Render_object();
-		std::vector<Triangle> triangles;
-		void add_triangle(std::vector<double> verts[3], char line_c = '*',
+		/* An instance of mesh, which t puts in the world */
+		explicit Render_object(const Shared_mesh &mesh,
+				const Transform &t = Transform());
+		/*
+		 * Turns obj into a mesh for instances to share. Nothing can change
+		 * it after that.
+		 */
+		static Shared_mesh share(Render_object &&obj);
+		/* Returns the index of the new vertex */
+		unsigned add_vertex(Vec3 v);
+		/* Adds a triangle between previously added vertices a, b and c */
+		void add_triangle(unsigned a, unsigned b, unsigned c,
+				char line_c = '*', enum fg_colour line_fg = fg_none,
+				enum bg_colour line_bg = bg_none, char fill_c = ' ',
+				enum fg_colour fill_fg = fg_none,
+				enum bg_colour fill_bg = bg_none);
+		/* Adds a triangle along with three new vertices for it */
+		void add_triangle(Vec3 verts[3], char line_c = '*',
 				enum fg_colour line_fg = fg_none,
 				enum bg_colour line_bg = bg_none, char fill_c = ' ',
 				enum fg_colour fill_fg = fg_none,
 				enum bg_colour fill_bg = bg_none);
+		size_t n_triangles() const { return geometry().styles.size(); }
+		/* Whose vertices, triangles and bounds get drawn */
+		const Render_object &geometry() const { return mesh ? *mesh : *this; }
+		/* Moves the object, which then gets drawn again */
+		void set_transform(const Transform &t)
+		{
+			this->transform = t;
+			this->changed = 1;
+		}
+		/* Bounds of what gets drawn, in the world */
+		Aabb world_bounds() const;
+		/*
+		 * Rebuilds the bounding volumes. The renderer does this itself
+		 * after add_vertex() or add_triangle(); anything that edits the
+		 * arrays below directly needs to set bounds_dirty.
+		 */
+		void update_bounds();
+
+		/*
+		 * These can all be borrowed (see cow_vector.hh), which is how a
+		 * scene cache gets rendered straight from the file
+		 */
+		Vertex_buffer vertices;
+		/* Three per triangle */
+		Cow_vector<unsigned> indices;
+		Cow_vector<Triangle_style> styles;
+		/* Bounds of the whole object and its parts, for culling */
+		Bvh bvh;
+		int bounds_dirty;
+		/*
+		 * Whether the object needs drawing again. add_vertex() and
+		 * add_triangle() set it, and the renderer takes bounds_dirty to
+		 * mean it too; anything else that changes how the object looks
+		 * (its styles, say, or cull_backfaces) needs to set it, or the
+		 * old picture of it stays on screen.
+		 */
+		int changed;
+		/*
+		 * Where on screen the renderer last drew it, which is what needs
+		 * redrawing when it moves or goes away. Kept up to date by the
+		 * renderer.
+		 */
+		Screen_rect drawn;
+		/*
+		 * Skip triangles that face away from the camera, i.e. whose vertices
+		 * appear clockwise on screen. Only makes sense for closed meshes
+		 * whose triangles are all wound anticlockwise seen from outside.
+		 * Off by default (an instance starts off with its mesh's).
+		 */
+		int cull_backfaces;
+
+		/* What this is an instance of, if anything */
+		Shared_mesh mesh;
+		/*
+		 * Where the model goes in the world. Changing it directly, rather
+		 * than through set_transform(), needs changed setting.
+		 */
+		Transform transform;
+		/*
+		 * If override_style is set, every triangle is drawn with style
+		 * rather than its own, so instances of a mesh can look different
+		 */
+		int override_style;
+		Triangle_style style;
+};
+
+/* What render() did last frame, for whoever is interested */
+struct Render_stats {
+	/* Triangles of every object looked at */
+	size_t triangles_submitted;
+	/*
+	 * Triangles set up and scanned. With more than one worker, or only
+	 * some of the screen being redrawn, a triangle counts once however many
+	 * tiles it is scanned in.
+	 */
+	size_t triangles_drawn;
+	/*
+	 * Cells scanned, and of those, the ones that already had something
+	 * nearer in them
+	 */
+	size_t cells_tested;
+	size_t depth_rejects;
+	/* Objects skipped entirely for being off-screen */
+	size_t objects_culled;
+	/* Triangles skipped for being off-screen, including those objects' */
+	size_t triangles_culled;
+	/* Triangles skipped for facing away, and the cells they'd have scanned */
+	size_t backfaces_culled;
+	size_t backface_cells_saved;
+	/*
+	 * Objects and triangles skipped for being behind what was already
+	 * drawn, and the cells that saved scanning. With more than one worker
+	 * this is done per tile, so a triangle counts once for each tile it was
+	 * skipped in.
+	 */
+	size_t objects_occluded;
+	size_t triangles_occluded;
+	size_t occluded_cells_saved;
+	/*
+	 * Tiles drawn: all of them, unless only some of the screen changed,
+	 * and none if nothing did
+	 */
+	size_t tiles_drawn;
 };
 
+/* Names an object added to a Renderer */
+typedef Slot_handle Object_handle;
+
 /*
  * Contains camera information, the list of things to render, and the array of
  * Render_symbols resulting from 3D rendering. Arguments are screen dimensions
  * (in characters), and distance from back of camera to plane
  * (render() works by intersecting lines (from the point at the back of the
  * camera to objects) with a plane, so depth determines field of vision with a 
- * fixed screen width of 5.0)
+ * fixed screen width of 5.0), how many objects to make room for up front
+ * (there can be more, it's only a hint), and how many
+ * threads to rasterise with (1 draws everything on the calling thread).
+ * Whatever the number of threads, the output is exactly the same.
+ * Finally, what to draw in (see raster.hh): double is the reference, float
+ * and fixed point trade a little precision for speed.
+ *
+ * Only what has changed since the last frame is drawn again: if the camera
+ * hasn't moved, that is the tiles where changed objects were or now are
+ * (see Render_object::changed), and if nothing has changed, nothing is drawn
+ * and updated is 0.
  */
 class Renderer {
 	public:
-		Renderer(int scr_y, int scr_x, double c_depth, int max_objects);
-		/* Returns a pointer to added object in case it needs modifying */
-		Render_object *add_object(Render_object obj);
+		Renderer(int scr_y, int scr_x, double c_depth, int objects_hint,
+				int n_workers = 1, Raster_format format = raster_double);
+		/*
+		 * Returns a handle to the added object, for changing or removing it
+		 * later. Pass big objects with std::move() (or add an empty one and
+		 * fill it in through object()) so that their arrays aren't copied.
+		 */
+		Object_handle add_object(const Render_object &obj);
+		Object_handle add_object(Render_object &&obj);
+		/* Returns 0 if h was already gone. What it covered gets redrawn. */
+		int remove_object(Object_handle h);
+		/*
+		 * The object h names, or 0 if it has been removed. The pointer is
+		 * good until the next add_object() or remove_object().
+		 */
+		Render_object *object(Object_handle h) { return objects.get(h); }
+		int object_count() const { return (int) objects.size(); }
 		/*
-		 * render() returns a reference to screen, the array of Render_symbols
-		 * produced
+		 * render() returns a view of screen, the grid of Render_symbols
+		 * produced. It stays valid until the next call.
 		 */
-		/* used to be *** */
-		Render_symbol **render();
+		Screen_span render();
+		/* Makes the next render() draw everything */
+		void invalidate() { this->redraw_all = 1; }
 		/*
-		 * Array is more suitable than a vector here: lacks dynamic
-		 * reallocation, but pointers don't spontaneously get invalidated
+		 * Makes the screen scr_y x scr_x (even, as for the constructor).
+		 * The next render() draws everything. Screen memory is only
+		 * reallocated when it grows past any size it has been before.
 		 */
-		Render_object *render_objects;
+		void resize(int scr_y, int scr_x);
+		/*
+		 * Distance of whatever was drawn in each cell, for the curious.
+		 * Good until the next render().
+		 */
+		Depth_span depth();
+		Raster_format format() const { return raster_format; }
+		/*
+		 * Times the stages of each frame with p (see profile.hh), or with
+		 * nothing if p is 0, which is how it starts. The caller begins and
+		 * ends p's frames.
+		 */
+		void set_profiler(Profiler *p) { this->profiler = p; }
+		Render_stats stats;
+		/*
+		 * Everything that gets drawn, packed together so that drawing goes
+		 * straight through an array. Removing an object moves another into
+		 * its place, hence the handles.
+		 */
+		Slot_map<Render_object> objects;
 		int screen_x, screen_y;
+		/* Whether the last render() changed anything on screen */
 		int updated;
 
-		std::vector<double> camera_pos;
+		/*
+		 * The camera for the next frame can be set directly, by whoever is
+		 * calling render(), or through set_camera(), from any thread at any
+		 * time. The latter is picked up when the next frame starts (and
+		 * overwrites these), so a frame never sees half a camera move.
+		 */
+		void set_camera(const Camera &c) { this->camera_box.store(c); }
+		Vec3 camera_pos;
 		/* Camera angle to x-axis in xy plane*/
 		double camera_xangle;
 		/* Camera angle to z-axis */
 		double camera_zangle;
 	private:
-		/* Takes a reference to avoid copying argument */
-		void draw_triangle(Triangle *t);
-		std::vector<double> *screen_project(Triangle *t);
+		/* Works out this frame's camera basis and frustum */
+		void begin_frame();
 		/*
-		 * Works out if a point (y, x) is inside the triangle spanned by u1 and
-		 * u2 with one vertex at r0
+		 * The rest works in a particular format (see raster.hh); render()
+		 * picks the one the renderer was made with
 		 */
-		int is_inside(std::vector<double> r0, std::vector<double> u1,
-				std::vector<double> u2, int y, int x);
+		template <typename F>
+		Screen_span render_frame();
+		template <typename F>
+		Raster_state<F> &raster_state()
+		{
+			return *static_cast<Raster_state<F> *>(this->raster.get());
+		}
+		/*
+		 * Culls obj against the frustum and, if any of it is left, projects
+		 * its vertices into the raster state. Returns 0 if none of obj is
+		 * visible. Otherwise *mask is 0 if all of it might be, or a bitmask
+		 * of the triangles that might be. Starts obj->drawn over.
+		 */
+		template <typename F>
+		int prepare_object(Render_object *obj, const uint64_t **mask);
+		/*
+		 * Triangle setup: fills in rt for triangle tri of obj, whose
+		 * vertices have been projected, putting its terms at
+		 * terms in the raster state. Returns 0 if there is nothing to draw.
+		 */
+		template <typename F>
+		int setup_triangle(const Render_object *obj, size_t tri,
+				Raster_triangle_t<F> *rt, size_t terms);
+		/*
+		 * Scans the cells of a set up triangle that lie within rows
+		 * sy0..sy1 and columns sx0..sx1 (inclusive, in array coordinates)
+		 * and writes them to screen. Adds what it skipped to stats.
+		 * Returns 0 if nothing was scanned because everything there is
+		 * already nearer.
+		 */
+		template <typename F>
+		int scan_triangle(const Raster_triangle_t<F> *rt, int sy0, int sy1,
+				int sx0, int sx1, Render_stats *stats);
+		/*
+		 * Whether everything drawn in rows y0..y1, columns x0..x1 (array
+		 * coordinates) is at most distance nearest away, in the depth
+		 * buffer's units
+		 */
+		template <typename F>
+		int occluded(int y0, int y1, int x0, int x1, double nearest);
+		template <typename F>
+		int object_occluded(const Aabb &b);
+		int screen_extent(const Aabb &b, Screen_rect *r) const;
+		/* Cells of a set up triangle */
+		template <typename F>
+		Screen_rect cells(const Raster_triangle_t<F> &rt) const;
 
 		/*
-		 * Calculates the distance (from the back of the camera) of the point
-		 * (y, x) of a triangle with a vertex at r0 and spanned by u1, u2
-		 * with the other vertices a distance dc1 or dc2 further from the origin
-		 * than r0, given the distance dist0 of r0 from the origin.
+		 * Incremental rendering. A tile is damaged when what's in it has to
+		 * be drawn again; find_damage() damages the tiles under changed
+		 * objects, before and after the change.
 		 */
-		double dist_calc(std::vector<double> r0, std::vector<double> u1,
-				std::vector<double> u2, double dist0, double dc1, double dc2,
-				int y, int x);
+		template <typename F>
+		void find_damage();
+		void damage(const Screen_rect &r);
+		int damaged(const Screen_rect &r) const;
+		int redraw_all;
+		/* The camera last frame was drawn with */
+		Camera last_camera;
+		/* For each tile, whether it's damaged; and a list of those that are */
+		std::vector<unsigned char> tile_damage;
+		std::vector<int> damaged_tiles;
+		/* Drawing straight to the screen, rather than binning into tiles */
+		int scan_directly;
+
+		Camera_basis basis;
+		Frustum frustum;
+		/* Which of its triangles survived culling, when not all of them */
+		std::vector<uint64_t> tri_mask;
+
+		/*
+		 * Drawing in tiles: see bin_triangle(), which returns 0 if rt
+		 * doesn't touch any damaged tile
+		 */
+		template <typename F>
+		int bin_triangle(const Raster_triangle_t<F> &rt);
+		template <typename F>
+		void raster_tile(int tile);
+		/* Sizes the tile arrays for the screen */
+		void setup_tiles();
+		/* Draws the i'th damaged tile */
+		template <typename F>
+		static void raster_tile_job(void *renderer, int i);
+		/* Tile size in cells */
+		static const int tile_w = 32;
+		static const int tile_h = 16;
+		int tiles_x, tiles_y;
+		/*
+		 * For each tile, the indices in the raster state's frame_tris of
+		 * triangles touching it
+		 */
+		std::vector<std::vector<int> > tile_bins;
+		/* What each tile skipped, added up after the workers are done */
+		std::vector<Render_stats> tile_stats;
+		/* Not there when drawing on one thread */
+		std::unique_ptr<Worker_pool> workers;
 
 		double camera_depth;
+		Camera_mailbox camera_box;
+		/* Version of camera_box last copied into camera_pos etc. */
+		unsigned camera_seen;
 		/*
-		 * Screen will not be in a valid state until render() has been invoked
-		 * at least once. Screen memory is allocated when Renderer is
-		 * constructed, and there is no mechanism to free it because Renderer
-		 * is supposed to be constantly in use.
-		 * Entries are ordered (column, row), with (0, 0) in top left-hand
+		 * The screen and everything else that depends on the format.
+		 * Screen memory is allocated when Renderer is constructed, as one
+		 * block per plane, and only grows (with room to spare) if resize()
+		 * makes it bigger.
+		 * Entries are ordered (row, column), with (0, 0) in top left-hand
 		 * corner of screen, as that is convenient for output.
 		 */
-		Render_symbol **screen;
-		int n_objects, max_objects;
+		Raster_format raster_format;
+		std::unique_ptr<Raster_state_base> raster;
+
+		Profiler *profiler;
 };
 
 #endif
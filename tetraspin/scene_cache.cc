@@ -0,0 +1,339 @@
+#include <cstddef>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "scene_cache.hh"
+
+static const char cache_magic[8] = {'T', 'S', 'P', 'N', 'S', 'C', 'N', 0};
+/* 2: Render_symbol became a packed word with palette indices */
+static const uint32_t cache_version = 2;
+static const uint32_t cache_byte_order = 0x01020304;
+static const uint64_t cache_align = 64;
+
+static int fail(std::string *error, const std::string &what)
+{
+	if (error)
+		*error = what;
+	return -1;
+}
+
+/* Writes sections one after another, padding each to cache_align */
+class Cache_writer {
+	public:
+		explicit Cache_writer(FILE *f) : f(f), pos(0), ok(1) {}
+		/* Returns where the n bytes at p went */
+		uint64_t section(const void *p, size_t n)
+		{
+			static const char zeros[cache_align] = {0};
+			size_t pad = (cache_align - pos % cache_align) % cache_align;
+			put(zeros, pad);
+			uint64_t at = pos;
+			put(p, n);
+			return at;
+		}
+		void put(const void *p, size_t n)
+		{
+			if (n && fwrite(p, 1, n, f) != n)
+				ok = 0;
+			pos += n;
+		}
+
+		FILE *f;
+		uint64_t pos;
+		int ok;
+};
+
+static void fill_header(Scene_cache_header *h, uint32_t n_objects)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, cache_magic, sizeof(cache_magic));
+	h->version = cache_version;
+	h->byte_order = cache_byte_order;
+	h->double_size = sizeof(double);
+	h->index_size = sizeof(unsigned);
+	h->style_size = sizeof(Triangle_style);
+	h->node_size = sizeof(Bvh::Node);
+	h->n_objects = n_objects;
+}
+
+int write_scene_cache(const char *path, Renderer *r, std::string *error)
+{
+	std::vector<Render_object *> objs;
+	for (int i = 0; i < r->object_count(); ++i)
+		objs.push_back(&r->objects[i]);
+	return write_scene_cache(path, objs.data(), objs.size(), error);
+}
+
+int write_scene_cache(const char *path, Render_object *const *objs, size_t n,
+		std::string *error)
+{
+	/* Objects are saved as their triangles, and nothing else */
+	for (size_t i = 0; i < n; ++i) {
+		const Render_object &obj = *objs[i];
+		if (obj.mesh || !obj.transform.is_identity() || obj.override_style)
+			return fail(error, std::string(path) + ": instances and moved "
+					"objects can't be saved in a scene cache");
+	}
+
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		return fail(error, tmp + ": " + strerror(errno));
+
+	Scene_cache_header h;
+	fill_header(&h, (uint32_t) n);
+	Cache_writer w(f);
+	/* Filled in properly at the end */
+	w.put(&h, sizeof(h));
+
+	std::vector<Scene_cache_object> table(n);
+	for (size_t i = 0; i < n; ++i) {
+		Render_object *obj = objs[i];
+		if (obj->bounds_dirty || !obj->bvh.built())
+			obj->update_bounds();
+		Scene_cache_object &t = table[i];
+		memset(&t, 0, sizeof(t));
+		const Vertex_buffer &v = obj->vertices;
+		t.n_vertices = v.size();
+		t.n_triangles = obj->n_triangles();
+		t.xs = w.section(v.xs.data(), v.size() * sizeof(double));
+		t.ys = w.section(v.ys.data(), v.size() * sizeof(double));
+		t.zs = w.section(v.zs.data(), v.size() * sizeof(double));
+		t.indices = w.section(obj->indices.data(),
+				obj->indices.size() * sizeof(unsigned));
+		t.styles = w.section(obj->styles.data(),
+				obj->styles.size() * sizeof(Triangle_style));
+
+		/* Copied a node at a time so that the padding is zeros */
+		const Cow_vector<Bvh::Node> &nodes = obj->bvh.node_array();
+		t.n_nodes = nodes.size();
+		t.nodes = w.section(0, 0);
+		for (size_t j = 0; j < nodes.size(); ++j) {
+			unsigned char node[sizeof(Bvh::Node)] = {0};
+			memcpy(node, &nodes[j], offsetof(Bvh::Node, left)
+					+ sizeof(unsigned));
+			w.put(node, sizeof(node));
+		}
+		const Cow_vector<unsigned> &order = obj->bvh.order_array();
+		t.order = w.section(order.data(), order.size() * sizeof(unsigned));
+		t.cull_backfaces = obj->cull_backfaces;
+	}
+	h.objects = w.section(table.data(), table.size() * sizeof(table[0]));
+	h.file_size = w.pos;
+
+	if (w.ok && (fseek(f, 0, SEEK_SET) || fwrite(&h, sizeof(h), 1, f) != 1))
+		w.ok = 0;
+	int e = errno;
+	if (fclose(f) != 0 && w.ok) {
+		e = errno;
+		w.ok = 0;
+	}
+	if (!w.ok) {
+		unlink(tmp.c_str());
+		return fail(error, tmp + ": " + strerror(e));
+	}
+	if (rename(tmp.c_str(), path) < 0) {
+		e = errno;
+		unlink(tmp.c_str());
+		return fail(error, std::string(path) + ": " + strerror(e));
+	}
+	return 0;
+}
+
+int is_scene_cache(const char *path)
+{
+	char magic[sizeof(cache_magic)];
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	int yes = fread(magic, sizeof(magic), 1, f) == 1
+		&& !memcmp(magic, cache_magic, sizeof(magic));
+	fclose(f);
+	return yes;
+}
+
+Scene_cache::Scene_cache()
+	: map(0), size(0), owned(0), header(0), objects(0)
+{
+}
+
+Scene_cache::~Scene_cache()
+{
+	this->close();
+}
+
+void Scene_cache::close()
+{
+	if (this->owned)
+		free(this->map);
+	else if (this->map)
+		munmap(this->map, this->size);
+	this->map = 0;
+	this->size = 0;
+	this->owned = 0;
+	this->header = 0;
+	this->objects = 0;
+}
+
+/* Whether n things of size each at offset at fit in the file, aligned */
+static int section_ok(uint64_t at, uint64_t n, uint64_t each, uint64_t size)
+{
+	if (at % cache_align || at > size)
+		return 0;
+	return n <= (size - at) / each;
+}
+
+int Scene_cache::open(const char *path, std::string *error)
+{
+	this->close();
+	std::string name(path);
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return fail(error, name + ": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int e = errno;
+		::close(fd);
+		return fail(error, name + ": " + strerror(e));
+	}
+	if ((size_t) st.st_size < sizeof(Scene_cache_header)) {
+		::close(fd);
+		return fail(error, name + ": too short to be a scene cache");
+	}
+	/* Shared, so that everyone showing this scene uses the same pages */
+	void *m = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	int e = errno;
+	::close(fd);
+	if (m == MAP_FAILED)
+		return fail(error, name + ": " + strerror(e));
+	this->map = m;
+	this->size = st.st_size;
+	return this->check(name, error);
+}
+
+int Scene_cache::read(const char *path, std::string *error)
+{
+	this->close();
+	std::string name(path);
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return fail(error, name + ": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int e = errno;
+		::close(fd);
+		return fail(error, name + ": " + strerror(e));
+	}
+	if ((size_t) st.st_size < sizeof(Scene_cache_header)) {
+		::close(fd);
+		return fail(error, name + ": too short to be a scene cache");
+	}
+	/* Aligned like the sections in it, as mmap() would have been */
+	void *m = 0;
+	if (posix_memalign(&m, cache_align, st.st_size) != 0) {
+		::close(fd);
+		return fail(error, name + ": out of memory");
+	}
+	size_t done = 0;
+	while (done < (size_t) st.st_size) {
+		ssize_t n = pread(fd, (char *) m + done, st.st_size - done, done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			int e = n < 0 ? errno : 0;
+			::close(fd);
+			free(m);
+			return fail(error, name + ": " + (e ? strerror(e) :
+						"scene cache has been cut short"));
+		}
+		done += n;
+	}
+	::close(fd);
+	this->map = m;
+	this->size = st.st_size;
+	this->owned = 1;
+	return this->check(name, error);
+}
+
+int Scene_cache::check(const std::string &name, std::string *error)
+{
+	const Scene_cache_header *h = (const Scene_cache_header *) this->map;
+	Scene_cache_header want;
+	fill_header(&want, h->n_objects);
+	const char *problem = 0;
+	uint64_t size = this->size;
+	if (memcmp(h->magic, want.magic, sizeof(want.magic)))
+		problem = "not a scene cache";
+	else if (h->version != want.version)
+		problem = "scene cache of another version";
+	else if (h->byte_order != want.byte_order)
+		problem = "scene cache of the other byte order";
+	else if (h->double_size != want.double_size
+			|| h->index_size != want.index_size
+			|| h->style_size != want.style_size
+			|| h->node_size != want.node_size)
+		problem = "scene cache written by an incompatible build";
+	else if (h->file_size != size)
+		problem = "scene cache has been cut short";
+	else if (!section_ok(h->objects, h->n_objects,
+				sizeof(Scene_cache_object), size))
+		problem = "corrupt scene cache";
+
+	const Scene_cache_object *table = (const Scene_cache_object *)
+		((const char *) this->map + h->objects);
+	for (uint32_t i = 0; !problem && i < h->n_objects; ++i) {
+		const Scene_cache_object &t = table[i];
+		if (!section_ok(t.xs, t.n_vertices, sizeof(double), size)
+				|| !section_ok(t.ys, t.n_vertices, sizeof(double), size)
+				|| !section_ok(t.zs, t.n_vertices, sizeof(double), size)
+				|| !section_ok(t.indices, t.n_triangles, 3 * sizeof(unsigned),
+					size)
+				|| !section_ok(t.styles, t.n_triangles,
+					sizeof(Triangle_style), size)
+				|| !section_ok(t.nodes, t.n_nodes, sizeof(Bvh::Node), size)
+				|| !section_ok(t.order, t.n_triangles, sizeof(unsigned), size)
+				|| !t.n_nodes)
+			problem = "corrupt scene cache";
+	}
+	if (problem) {
+		this->close();
+		return fail(error, name + ": " + problem);
+	}
+
+	this->header = h;
+	this->objects = table;
+	return 0;
+}
+
+int Scene_cache::add_to(Renderer *r, std::vector<Object_handle> *handles) const
+{
+	const char *base = (const char *) this->map;
+	int added = 0;
+	for (int i = 0; i < this->n_objects(); ++i) {
+		const Scene_cache_object &t = this->objects[i];
+		Render_object obj;
+		obj.vertices.xs.borrow((const double *) (base + t.xs), t.n_vertices);
+		obj.vertices.ys.borrow((const double *) (base + t.ys), t.n_vertices);
+		obj.vertices.zs.borrow((const double *) (base + t.zs), t.n_vertices);
+		obj.indices.borrow((const unsigned *) (base + t.indices),
+				3 * t.n_triangles);
+		obj.styles.borrow((const Triangle_style *) (base + t.styles),
+				t.n_triangles);
+		obj.bvh.borrow((const Bvh::Node *) (base + t.nodes), t.n_nodes,
+				(const unsigned *) (base + t.order), t.n_triangles);
+		obj.bounds_dirty = 0;
+		obj.cull_backfaces = t.cull_backfaces;
+		Object_handle h = r->add_object(std::move(obj));
+		if (handles)
+			handles->push_back(h);
+		++added;
+	}
+	return added;
+}
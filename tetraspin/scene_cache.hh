@@ -0,0 +1,108 @@
+#ifndef SCENE_CACHE_H_I
+#define SCENE_CACHE_H_I
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "render.hh"
+
+/*
+ * Scene cache: a Renderer's objects saved in the form it keeps them in
+ * memory, so that loading one is mapping the file and pointing the objects
+ * at it, with nothing to parse or build. Several processes showing the same
+ * scene share the one copy in the page cache.
+ *
+ * Layout (all offsets from the start of the file, every section aligned to
+ * 64 bytes, everything in the writer's byte order):
+ *   Scene_cache_header
+ *   for each object: x, y and z arrays (double), indices (3 unsigned a
+ *       triangle), styles (one Triangle_style a triangle), BVH nodes and
+ *       the BVH's triangle order
+ *   Scene_cache_object table, one per object
+ * The header records the sizes of the structs stored as they are; a file
+ * written by a build where those differ (or of another version or byte
+ * order) is refused rather than converted, as it's only a cache.
+ */
+struct Scene_cache_header {
+	char magic[8];
+	uint32_t version;
+	/* 0x01020304 as the writer stores it */
+	uint32_t byte_order;
+	uint32_t double_size, index_size, style_size, node_size;
+	uint32_t n_objects;
+	uint32_t reserved;
+	/* Where the object table is, and how big the file should be */
+	uint64_t objects;
+	uint64_t file_size;
+};
+
+struct Scene_cache_object {
+	uint64_t n_vertices, n_triangles, n_nodes;
+	/* Offsets of the sections */
+	uint64_t xs, ys, zs, indices, styles, nodes, order;
+	uint32_t cull_backfaces;
+	uint32_t reserved;
+};
+
+/*
+ * Saves all of r's objects to path (via a temporary file, so anyone with the
+ * old one mapped keeps it intact), building their BVHs first if need be.
+ * Only objects with triangles of their own, where they are, can be saved
+ * (not instances, or objects with a transform).
+ * Returns 0, or -1 with a description in *error if error isn't 0.
+ */
+int write_scene_cache(const char *path, Renderer *r, std::string *error = 0);
+/* Or just the n objects at objs, which needn't be in a renderer */
+int write_scene_cache(const char *path, Render_object *const *objs, size_t n,
+		std::string *error = 0);
+
+/* Whether path starts like a scene cache */
+int is_scene_cache(const char *path);
+
+/*
+ * A mapped scene cache. The header and table are checked when it is opened,
+ * but the arrays themselves are trusted, as reading them all would defeat
+ * the point: don't point it at files from strangers.
+ */
+class Scene_cache {
+	public:
+		Scene_cache();
+		~Scene_cache();
+		/* Returns 0, or -1 (with a reason in *error) */
+		int open(const char *path, std::string *error = 0);
+		/*
+		 * Reads the whole file into memory of its own instead of mapping
+		 * it, so that drawing from it can never wait for the disk (the
+		 * kernel can drop a mapping's pages and read them again whenever
+		 * it likes). As for open().
+		 */
+		int read(const char *path, std::string *error = 0);
+		void close();
+		int n_objects() const { return header ? (int) header->n_objects : 0; }
+		/* How much memory it takes, or how much file is mapped */
+		size_t bytes() const { return size; }
+		/*
+		 * Adds the cached objects to r, borrowing their arrays from the
+		 * mapping, which therefore has to stay open for as long as r uses
+		 * them. Returns the number added, and appends their handles to
+		 * *handles if handles isn't 0.
+		 */
+		int add_to(Renderer *r, std::vector<Object_handle> *handles = 0) const;
+
+	private:
+		Scene_cache(const Scene_cache &);
+		Scene_cache &operator=(const Scene_cache &);
+
+		/* Checks the header and table once the file is in memory */
+		int check(const std::string &name, std::string *error);
+
+		void *map;
+		size_t size;
+		/* Whether map came from read() rather than mmap() */
+		int owned;
+		const Scene_cache_header *header;
+		const Scene_cache_object *objects;
+};
+
+#endif
@@ -0,0 +1,386 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#include "scenes.hh"
+#include "world_setup.hh"
+
+/* Regular tetrahedron, base down, wound so its back can be culled */
+static void add_tetrahedron(Render_object *obj, Vec3 base, double length,
+		enum fg_colour fg, enum bg_colour bg)
+{
+	Vec3 corners[4] = {Vec3(0.0, -1.0, 0.0),
+					   Vec3(-cos(M_PI/6), sin(M_PI/6), 0.0),
+					   Vec3(cos(M_PI/6), sin(M_PI/6), 0.0),
+					   Vec3(0.0, 0.0, sqrt(2.0/3.0))};
+	unsigned idx[4];
+	for (int i = 0; i < 4; ++i)
+		idx[i] = obj->add_vertex(vec_add(vec_mult(corners[i], length), base));
+	int faces[4][3] = {{0, 1, 2}, {0, 3, 1}, {0, 2, 3}, {1, 3, 2}};
+	for (int i = 0; i < 4; ++i) {
+		obj->add_triangle(idx[faces[i][0]], idx[faces[i][1]],
+				idx[faces[i][2]], '-', fg, bg_none, '*', fg_none, bg);
+	}
+	obj->cull_backfaces = 1;
+}
+
+/*
+ * UV sphere with n bands of latitude and 2n of longitude, every vertex
+ * shared by up to six triangles. The poles are along y, so that the camera
+ * going round doesn't see the same thing every frame.
+ */
+/* Where add_sphere() puts vertex k of a sphere, from its centre */
+static Vec3 sphere_vertex(double radius, int n, int k)
+{
+	double th = M_PI * (k / (2 * n)) / n;
+	double ph = M_PI * (k % (2 * n)) / n;
+	return Vec3(radius * sin(th) * cos(ph), radius * cos(th),
+			radius * sin(th) * sin(ph));
+}
+
+static void add_sphere(Render_object *obj, Vec3 centre, double radius, int n)
+{
+	unsigned first = (unsigned) obj->vertices.size();
+	for (int k = 0; k < (n + 1) * 2 * n; ++k)
+		obj->add_vertex(vec_add(centre, sphere_vertex(radius, n, k)));
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < 2 * n; ++j) {
+			unsigned a = first + i * 2 * n + j;
+			unsigned b = first + i * 2 * n + (j + 1) % (2 * n);
+			unsigned c = a + 2 * n;
+			unsigned d = b + 2 * n;
+			/* Alternate the fill so the bands are visible */
+			enum bg_colour bg = ((i + j) & 1) ? bg_blue : bg_cyan;
+			obj->add_triangle(a, d, b, '.', fg_b_white, bg, ' ', fg_none, bg);
+			obj->add_triangle(a, c, d, '.', fg_b_white, bg, ' ', fg_none, bg);
+		}
+	}
+	obj->cull_backfaces = 1;
+}
+
+/*
+ * Axis-aligned cube around centre, with each face in its own symbol. Both
+ * sides of every face get drawn.
+ */
+static void add_cube(Render_object *obj, Vec3 centre, double half,
+		enum bg_colour bg)
+{
+	unsigned idx[8];
+	for (int i = 0; i < 8; ++i) {
+		idx[i] = obj->add_vertex(vec_add(centre, Vec3(i & 1 ? half : -half,
+						i & 2 ? half : -half, i & 4 ? half : -half)));
+	}
+	int faces[6][4] = {{0, 1, 3, 2}, {4, 5, 7, 6}, {0, 1, 5, 4},
+					   {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 3, 7, 5}};
+	for (int i = 0; i < 6; ++i) {
+		char c = "#%@&=o"[i];
+		obj->add_triangle(idx[faces[i][0]], idx[faces[i][1]], idx[faces[i][2]],
+				'+', fg_black, bg, c, fg_black, bg);
+		obj->add_triangle(idx[faces[i][0]], idx[faces[i][2]], idx[faces[i][3]],
+				'+', fg_black, bg, c, fg_black, bg);
+	}
+}
+
+static size_t build_tetrahedron(Renderer *r)
+{
+	setup(r);
+	return 4;
+}
+
+static size_t build_sphere(Renderer *r)
+{
+	Render_object obj;
+	add_sphere(&obj, Vec3(0.0, 60.0, 0.0), 20.0, 64);
+	size_t n = obj.n_triangles();
+	r->add_object(std::move(obj));
+	return n;
+}
+
+static size_t build_spheres(Renderer *r)
+{
+	size_t n = 0;
+	for (int i = 0; i < 5; ++i) {
+		for (int j = 0; j < 5; ++j) {
+			Render_object obj;
+			add_sphere(&obj, Vec3(i * 24.0 - 48.0, 60.0 + j * 24.0 - 48.0, 0.0),
+					8.0, 24);
+			n += obj.n_triangles();
+			r->add_object(std::move(obj));
+		}
+	}
+	return n;
+}
+
+static size_t build_grid(Renderer *r)
+{
+	static const enum fg_colour fgs[4] = {fg_red, fg_green, fg_yellow, fg_blue};
+	static const enum bg_colour bgs[4] = {bg_white, bg_magenta, bg_cyan,
+		bg_yellow};
+	size_t n = 0;
+	for (int i = 0; i < 64; ++i) {
+		for (int j = 0; j < 64; ++j) {
+			Render_object obj;
+			add_tetrahedron(&obj, Vec3(i * 6.0 - 189.0, 60.0 + j * 6.0 - 189.0,
+						-8.0), 2.5, fgs[(i + j) & 3], bgs[(i * j) & 3]);
+			n += obj.n_triangles();
+			r->add_object(std::move(obj));
+		}
+	}
+	return n;
+}
+
+static size_t build_overdraw(Renderer *r)
+{
+	static const enum bg_colour bgs[4] = {bg_red, bg_green, bg_blue,
+		bg_magenta};
+	size_t n = 0;
+	/*
+	 * Nested cubes, innermost first, so that every one drawn is nearer than
+	 * the last wherever the camera is
+	 */
+	for (int i = 0; i < 32; ++i) {
+		Render_object obj;
+		add_cube(&obj, Vec3(0.0, 60.0, 0.0), 4.0 + i * 0.5, bgs[i & 3]);
+		n += obj.n_triangles();
+		r->add_object(std::move(obj));
+	}
+	return n;
+}
+
+/*
+ * A mostly still scene: a wall of spheres, with a couple of little ones going
+ * round in front of part of it
+ */
+/*
+ * Every Renderer the scene is built in hands out the same handles, as the
+ * objects go in in the same order, so one copy of these does for all of them
+ */
+static Object_handle movers[2];
+static const int n_movers = sizeof(movers) / sizeof(movers[0]);
+static const double mover_radius = 2.0;
+static const int mover_detail = 8;
+
+static Vec3 mover_centre(int i, int frame)
+{
+	double a = 0.05 * frame + i * M_PI;
+	return Vec3(-20.0 + 8.0 * cos(a), 40.0, 6.0 + 4.0 * sin(a));
+}
+
+static size_t build_movers(Renderer *r)
+{
+	size_t n = 0;
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			Render_object obj;
+			add_sphere(&obj, Vec3(i * 20.0 - 50.0, 80.0, j * 20.0 - 20.0),
+					8.0, 16);
+			n += obj.n_triangles();
+			r->add_object(std::move(obj));
+		}
+	}
+	for (int i = 0; i < n_movers; ++i) {
+		Render_object obj;
+		add_sphere(&obj, mover_centre(i, 0), mover_radius, mover_detail);
+		n += obj.n_triangles();
+		movers[i] = r->add_object(std::move(obj));
+	}
+	return n;
+}
+
+/*
+ * Rewrites the vertices from scratch, where add_sphere() would have put
+ * them, rather than moving them on from where they were: adding up steps
+ * would make the result depend on which frames came before
+ */
+static void animate_movers(Renderer *r, int frame)
+{
+	for (int i = 0; i < n_movers; ++i) {
+		Render_object *obj = r->object(movers[i]);
+		Vec3 centre = mover_centre(i, frame);
+		Vertex_buffer &v = obj->vertices;
+		for (size_t j = 0; j < v.size(); ++j) {
+			Vec3 p = vec_add(centre,
+					sphere_vertex(mover_radius, mover_detail, (int) j));
+			v.xs[j] = p.x;
+			v.ys[j] = p.y;
+			v.zs[j] = p.z;
+		}
+		obj->bounds_dirty = 1;
+	}
+}
+
+/*
+ * 100x100 copies of one little sphere, each turning and bobbing up and down
+ * on its own. They are instances of a shared mesh, so there's only one copy
+ * of its triangles, and moving them is a new transform each rather than
+ * rewriting vertices.
+ */
+static const int herd_side = 100;
+static Object_handle herd[herd_side * herd_side];
+
+static Transform herd_transform(int i, int frame)
+{
+	int x = i % herd_side, y = i / herd_side;
+	Transform t;
+	t.set_rotation(0.1 * frame + i, 0.5, 0.0);
+	/* A few sizes, so that scaling gets some use too */
+	t.scale = 1.0 + 0.25 * ((x * 7 + y * 3) % 4);
+	t.translation = Vec3(x * 5.0 - 247.5, 60.0 + y * 5.0 - 247.5,
+			-4.0 + sin(0.1 * frame + x * 0.5 + y * 0.3));
+	return t;
+}
+
+static size_t build_herd(Renderer *r)
+{
+	static const enum fg_colour fgs[4] = {fg_red, fg_green, fg_yellow, fg_blue};
+	Render_object sphere;
+	add_sphere(&sphere, Vec3(0.0, 0.0, 0.0), 1.2, 4);
+	Shared_mesh mesh = Render_object::share(std::move(sphere));
+	size_t n = 0;
+	for (int i = 0; i < herd_side * herd_side; ++i) {
+		Render_object obj(mesh, herd_transform(i, 0));
+		/* Every fourth one stands out */
+		if (i % 4 == 0) {
+			obj.override_style = 1;
+			obj.style.line_symbol = Render_symbol('+', fgs[i / 4 & 3]);
+			obj.style.fill_symbol = Render_symbol('o', fgs[i / 4 & 3]);
+		}
+		n += obj.n_triangles();
+		herd[i] = r->add_object(std::move(obj));
+	}
+	return n;
+}
+
+static void animate_herd(Renderer *r, int frame)
+{
+	for (int i = 0; i < herd_side * herd_side; ++i)
+		r->object(herd[i])->set_transform(herd_transform(i, frame));
+}
+
+const Scene scenes[] = {
+	{"tetrahedron", "the spinning tetrahedron from main",
+		build_tetrahedron, 1, 0.0, 60.0, 30.0, 0.0, 0.02, 0},
+	{"sphere", "one UV sphere, 16384 triangles",
+		build_sphere, 1, 0.0, 60.0, 45.0, 0.0, 0.02, 0},
+	{"spheres", "5x5 spheres of 2304 triangles",
+		build_spheres, 25, 0.0, 60.0, 90.0, 0.0, 0.02, 0},
+	{"grid", "64x64 tetrahedra, mostly off-screen",
+		build_grid, 4096, 0.0, 60.0, 60.0, 12.0, 0.02, 0},
+	{"overdraw", "32 nested cubes drawn inside out",
+		build_overdraw, 32, 0.0, 60.0, 40.0, 8.0, 0.02, 0},
+	{"movers", "a still wall of spheres, two small ones moving",
+		build_movers, 20, 0.0, 0.0, 0.0, 0.0, 0.0, animate_movers},
+	{"herd", "100x100 instances of one sphere, all moving",
+		build_herd, herd_side * herd_side, 0.0, 60.0, 40.0, 10.0, 0.02,
+		animate_herd},
+};
+const int n_scenes = sizeof(scenes) / sizeof(scenes[0]);
+
+const Scene *find_scene(const char *name)
+{
+	for (int i = 0; i < n_scenes; ++i) {
+		if (!strcmp(scenes[i].name, name))
+			return &scenes[i];
+	}
+	return 0;
+}
+
+void scene_camera(const Scene *s, int frame, Renderer *r)
+{
+	/*
+	 * Same orbit as main: turning at the same rate as going round keeps
+	 * the camera pointing at the centre
+	 */
+	double theta = -s->omega * (frame + 1);
+	r->camera_xangle = theta;
+	r->camera_zangle = 0.0;
+	r->camera_pos[0] = s->centre_x + s->radius * sin(theta);
+	r->camera_pos[1] = s->centre_y - s->radius * cos(theta);
+	r->camera_pos[2] = s->height;
+	if (s->animate)
+		s->animate(r, frame);
+}
+
+std::vector<std::string> split_list(const char *list)
+{
+	std::vector<std::string> out;
+	std::string cur;
+	for (; *list; ++list) {
+		if (*list == ',') {
+			out.push_back(cur);
+			cur.clear();
+		} else {
+			cur += *list;
+		}
+	}
+	out.push_back(cur);
+	return out;
+}
+
+int parse_scenes(const char *list, std::vector<const Scene *> *out)
+{
+	std::vector<std::string> names = split_list(list);
+	for (size_t i = 0; i < names.size(); ++i) {
+		const Scene *s = find_scene(names[i].c_str());
+		if (!s) {
+			fprintf(stderr, "no scene called '%s'\n", names[i].c_str());
+			return -1;
+		}
+		out->push_back(s);
+	}
+	return 0;
+}
+
+int parse_sizes(const char *list, std::vector<std::pair<int, int> > *out)
+{
+	std::vector<std::string> sizes = split_list(list);
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		int w, h;
+		/* Odd sizes don't divide evenly round the centre */
+		if (sscanf(sizes[i].c_str(), "%dx%d", &w, &h) != 2 || w < 2 || h < 2
+				|| (w & 1) || (h & 1)) {
+			fprintf(stderr, "bad size '%s' (want even WxH)\n",
+					sizes[i].c_str());
+			return -1;
+		}
+		out->push_back(std::make_pair(w, h));
+	}
+	return 0;
+}
+
+int parse_workers(const char *list, std::vector<int> *out)
+{
+	std::vector<std::string> counts = split_list(list);
+	for (size_t i = 0; i < counts.size(); ++i) {
+		int n = atoi(counts[i].c_str());
+		if (n < 1) {
+			fprintf(stderr, "bad number of workers '%s'\n",
+					counts[i].c_str());
+			return -1;
+		}
+		out->push_back(n);
+	}
+	return 0;
+}
+
+int parse_formats(const char *list, std::vector<Raster_format> *out)
+{
+	std::vector<std::string> names = split_list(list);
+	for (size_t i = 0; i < names.size(); ++i) {
+		int f = raster_format_from_name(names[i].c_str());
+		if (f < 0) {
+			fprintf(stderr, "no raster format called '%s'\n",
+					names[i].c_str());
+			return -1;
+		}
+		out->push_back((Raster_format) f);
+	}
+	return 0;
+}
+
+void print_scenes(FILE *f)
+{
+	for (int i = 0; i < n_scenes; ++i)
+		fprintf(f, "  %-12s %s\n", scenes[i].name, scenes[i].description);
+}
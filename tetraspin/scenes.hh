@@ -0,0 +1,67 @@
+#ifndef SCENES_H_I
+#define SCENES_H_I
+
+#include <cstddef>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "render.hh"
+
+/*
+ * Canned scenes for benchmarking and testing, each with a camera path that
+ * only depends on the frame number so that runs can be compared.
+ */
+struct Scene {
+	const char *name;
+	const char *description;
+	/* Adds the scene's objects; returns how many triangles it added */
+	size_t (*build)(Renderer *r);
+	/* How many objects there will be, so room can be made up front */
+	int max_objects;
+	/*
+	 * The camera circles (centre_x, centre_y) at this radius and height,
+	 * turning omega radians a frame (so with omega 0 it stays put)
+	 */
+	double centre_x, centre_y;
+	double radius;
+	double height;
+	double omega;
+	/*
+	 * Puts things where they are on frame, wherever they were before; 0 if
+	 * nothing in the scene moves
+	 */
+	void (*animate)(Renderer *r, int frame);
+};
+
+extern const Scene scenes[];
+extern const int n_scenes;
+
+/* Returns 0 if there is no scene called name */
+const Scene *find_scene(const char *name);
+/*
+ * Puts the camera where it is on frame n of scene s's path, and anything
+ * that moves where it is then. Nothing depends on the frames before, so
+ * frames can be rendered in any order.
+ */
+void scene_camera(const Scene *s, int frame, Renderer *r);
+
+/*
+ * For the options of the programs that run the scenes (bench and verify),
+ * which take comma-separated lists. The parse_ functions add what list names
+ * to *out and return 0, or return -1 having said what's wrong on stderr.
+ */
+std::vector<std::string> split_list(const char *list);
+/* Scene names */
+int parse_scenes(const char *list, std::vector<const Scene *> *out);
+/* Sizes as WxH, both even */
+int parse_sizes(const char *list, std::vector<std::pair<int, int> > *out);
+/* Numbers of workers, at least one */
+int parse_workers(const char *list, std::vector<int> *out);
+/* Raster formats by name (see raster_format_from_name()) */
+int parse_formats(const char *list, std::vector<Raster_format> *out);
+/* Lists the scenes' names and descriptions, for usage messages */
+void print_scenes(FILE *f);
+
+#endif
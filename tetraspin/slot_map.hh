@@ -0,0 +1,143 @@
+#ifndef SLOT_MAP_H_I
+#define SLOT_MAP_H_I
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Names something in a Slot_map. Unlike a pointer it can be checked: once
+ * the thing is removed, the handle stops working rather than pointing at
+ * whatever takes its place. A default-constructed handle never works.
+ */
+struct Slot_handle {
+	uint32_t index;
+	uint32_t generation;
+
+	Slot_handle() : index(0), generation(0) {}
+	Slot_handle(uint32_t i, uint32_t g) : index(i), generation(g) {}
+	bool operator==(const Slot_handle &h) const
+	{
+		return index == h.index && generation == h.generation;
+	}
+	bool operator!=(const Slot_handle &h) const { return !(*this == h); }
+};
+
+/*
+ * Things kept packed together in one array, so that going through all of
+ * them is going through an array, with handles that survive others being
+ * added and removed. Adding and removing are O(1): removing moves the last
+ * thing into the gap, so the order of the array changes, and pointers into
+ * it only last until the next add or remove. Handles last until what they
+ * name is removed.
+ */
+template <typename T>
+class Slot_map {
+	public:
+		explicit Slot_map(size_t capacity = 0)
+			: free_head(none)
+		{
+			this->reserve(capacity);
+		}
+		void reserve(size_t n)
+		{
+			items.reserve(n);
+			owner.reserve(n);
+			slots.reserve(n);
+		}
+
+		Slot_handle add(T &&item)
+		{
+			uint32_t s = this->new_slot();
+			slots[s].dense = (uint32_t) items.size();
+			items.push_back(std::move(item));
+			owner.push_back(s);
+			return Slot_handle(s, slots[s].generation);
+		}
+		Slot_handle add(const T &item)
+		{
+			T copy(item);
+			return this->add(std::move(copy));
+		}
+
+		/* Returns 0 if h was stale */
+		int remove(Slot_handle h)
+		{
+			if (!this->get(h))
+				return 0;
+			uint32_t gap = slots[h.index].dense;
+			uint32_t last = (uint32_t) items.size() - 1;
+			if (gap != last) {
+				items[gap] = std::move(items[last]);
+				owner[gap] = owner[last];
+				slots[owner[gap]].dense = gap;
+			}
+			items.pop_back();
+			owner.pop_back();
+			/* Bumping the generation is what makes old handles stale */
+			++slots[h.index].generation;
+			slots[h.index].dense = free_head;
+			free_head = h.index;
+			return 1;
+		}
+
+		/* 0 if h is stale */
+		T *get(Slot_handle h)
+		{
+			if (h.index >= slots.size()
+					|| slots[h.index].generation != h.generation)
+				return 0;
+			return &items[slots[h.index].dense];
+		}
+		const T *get(Slot_handle h) const
+		{
+			return const_cast<Slot_map *>(this)->get(h);
+		}
+		/* The handle of the i'th thing in the array */
+		Slot_handle handle(size_t i) const
+		{
+			return Slot_handle(owner[i], slots[owner[i]].generation);
+		}
+
+		size_t size() const { return items.size(); }
+		bool empty() const { return items.empty(); }
+		T &operator[](size_t i) { return items[i]; }
+		const T &operator[](size_t i) const { return items[i]; }
+		T *begin() { return items.data(); }
+		T *end() { return items.data() + items.size(); }
+		const T *begin() const { return items.data(); }
+		const T *end() const { return items.data() + items.size(); }
+
+	private:
+		static const uint32_t none = 0xffffffff;
+
+		struct Slot {
+			/* Where the thing is in items, or the next free slot */
+			uint32_t dense;
+			/* Odd while in use, so 0 (the default handle) never matches */
+			uint32_t generation;
+		};
+
+		uint32_t new_slot()
+		{
+			uint32_t s = free_head;
+			if (s != none) {
+				free_head = slots[s].dense;
+			} else {
+				s = (uint32_t) slots.size();
+				Slot slot = {0, 0};
+				slots.push_back(slot);
+			}
+			++slots[s].generation;
+			return s;
+		}
+
+		/* The things themselves, and which slot each belongs to */
+		std::vector<T> items;
+		std::vector<uint32_t> owner;
+		std::vector<Slot> slots;
+		uint32_t free_head;
+};
+
+#endif
@@ -1,21 +1,189 @@
 #ifndef VEC_OPS_H_I
 #define VEC_OPS_H_I
 
+#include <math.h>
+
 /*
- * Implemented using vector<double> rather than double[3] because vector<double>
- * is C++-specific
+ * Fixed-size vectors passed around by value. These used to be
+ * vector<double>, which meant a trip to the heap for every addition; now
+ * everything lives on the stack (or in registers) and the compiler can inline
+ * the lot. Templated on the scalar type: the world is in double, but
+ * rasterising in float or fixed point (see raster.hh) uses Vec2_t<float> and
+ * Vec2_t<int32_t> too.
  */
-#include <vector>
-/* Only need operations for vectors of doubles */
-double vec_dot(std::vector<double> a, std::vector<double> b);
-std::vector<double> vec_add(std::vector<double> a, std::vector<double> b);
+template <typename T>
+struct Vec2_t {
+	T x, y;
+
+	constexpr Vec2_t() : x(0), y(0) {}
+	constexpr Vec2_t(T x_, T y_) : x(x_), y(y_) {}
+
+	/* Index access for code that still thinks in components */
+	T &operator[](int i) { return i ? y : x; }
+	constexpr T operator[](int i) const { return i ? y : x; }
+};
+
+template <typename T>
+struct Vec3_t {
+	T x, y, z;
+
+	constexpr Vec3_t() : x(0), y(0), z(0) {}
+	constexpr Vec3_t(T x_, T y_, T z_) : x(x_), y(y_), z(z_) {}
+
+	T &operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+	constexpr T operator[](int i) const
+	{
+		return i == 0 ? x : (i == 1 ? y : z);
+	}
+	/* Drops the last component, e.g. to get the screen position only */
+	constexpr Vec2_t<T> xy() const { return Vec2_t<T>(x, y); }
+};
+
+typedef Vec2_t<double> Vec2;
+typedef Vec3_t<double> Vec3;
+
+template <typename T>
+constexpr T vec_dot(Vec2_t<T> a, Vec2_t<T> b)
+{
+	return a.x * b.x + a.y * b.y;
+}
+
+template <typename T>
+constexpr T vec_dot(Vec3_t<T> a, Vec3_t<T> b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename T>
+constexpr Vec2_t<T> vec_add(Vec2_t<T> a, Vec2_t<T> b)
+{
+	return Vec2_t<T>(a.x + b.x, a.y + b.y);
+}
+
+template <typename T>
+constexpr Vec3_t<T> vec_add(Vec3_t<T> a, Vec3_t<T> b)
+{
+	return Vec3_t<T>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
 /* It is convenient to have a separate subtraction function. Returns a - b */
-std::vector<double> vec_sub(std::vector<double> a, std::vector<double> b);
-std::vector<double> vec_mult(std::vector<double> a, double b);
-std::vector<double> vec_cross(std::vector<double> a, std::vector<double> b);
+template <typename T>
+constexpr Vec2_t<T> vec_sub(Vec2_t<T> a, Vec2_t<T> b)
+{
+	return Vec2_t<T>(a.x - b.x, a.y - b.y);
+}
+
+template <typename T>
+constexpr Vec3_t<T> vec_sub(Vec3_t<T> a, Vec3_t<T> b)
+{
+	return Vec3_t<T>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template <typename T>
+constexpr Vec2_t<T> vec_mult(Vec2_t<T> a, T b)
+{
+	return Vec2_t<T>(a.x * b, a.y * b);
+}
+
+template <typename T>
+constexpr Vec3_t<T> vec_mult(Vec3_t<T> a, T b)
+{
+	return Vec3_t<T>(a.x * b, a.y * b, a.z * b);
+}
+
+template <typename T>
+constexpr Vec3_t<T> vec_cross(Vec3_t<T> a, Vec3_t<T> b)
+{
+	return Vec3_t<T>(a.y * b.z - b.y * a.z,
+			a.z * b.x - b.z * a.x,
+			a.x * b.y - b.x * a.y);
+}
+
 /* returns the reciprocal vector of a for the pair of 2d vectors (a, b) */
-std::vector<double> vec_recip2(std::vector<double> a, std::vector<double> b);
+template <typename T>
+constexpr Vec2_t<T> vec_recip2(Vec2_t<T> a, Vec2_t<T> b)
+{
+	return vec_mult(Vec2_t<T>(-b.y, b.x), T(1) / vec_dot(Vec2_t<T>(-b.y, b.x), a));
+}
+
+/* Operators, for when the function names get in the way of reading */
+template <typename T>
+constexpr Vec2_t<T> operator+(Vec2_t<T> a, Vec2_t<T> b) { return vec_add(a, b); }
+template <typename T>
+constexpr Vec3_t<T> operator+(Vec3_t<T> a, Vec3_t<T> b) { return vec_add(a, b); }
+template <typename T>
+constexpr Vec2_t<T> operator-(Vec2_t<T> a, Vec2_t<T> b) { return vec_sub(a, b); }
+template <typename T>
+constexpr Vec3_t<T> operator-(Vec3_t<T> a, Vec3_t<T> b) { return vec_sub(a, b); }
+template <typename T>
+constexpr Vec2_t<T> operator*(Vec2_t<T> a, T b) { return vec_mult(a, b); }
+template <typename T>
+constexpr Vec3_t<T> operator*(Vec3_t<T> a, T b) { return vec_mult(a, b); }
+
+/*
+ * Where a model goes in the world: scaled, rotated, then moved, so that
+ * model point p ends up at translation + scale * (rotation p). Scaling is
+ * the same in every direction, so distances just scale with it.
+ */
+struct Transform {
+	/* Rows of the rotation matrix */
+	Vec3 rot[3];
+	double scale;
+	Vec3 translation;
+
+	/* Leaves everything where it is */
+	Transform() : scale(1.0), translation(0, 0, 0)
+	{
+		rot[0] = Vec3(1, 0, 0);
+		rot[1] = Vec3(0, 1, 0);
+		rot[2] = Vec3(0, 0, 1);
+	}
+
+	/*
+	 * Roll radians about the y-axis, then pitch about the x-axis, then
+	 * yaw about the z-axis
+	 */
+	void set_rotation(double yaw, double pitch, double roll)
+	{
+		double cy = cos(yaw), sy = sin(yaw);
+		double cp = cos(pitch), sp = sin(pitch);
+		double cr = cos(roll), sr = sin(roll);
+		rot[0] = Vec3(cy*cr - sy*sp*sr, -sy*cp, cy*sr + sy*sp*cr);
+		rot[1] = Vec3(sy*cr + cy*sp*sr, cy*cp, sy*sr - cy*sp*cr);
+		rot[2] = Vec3(-cp*sr, sp, cp*cr);
+	}
+
+	int is_identity() const
+	{
+		return scale == 1.0 && translation.x == 0.0 &&
+			translation.y == 0.0 && translation.z == 0.0 &&
+			rot[0].x == 1.0 && rot[1].y == 1.0 && rot[2].z == 1.0 &&
+			rot[0].y == 0.0 && rot[0].z == 0.0 && rot[1].x == 0.0 &&
+			rot[1].z == 0.0 && rot[2].x == 0.0 && rot[2].y == 0.0;
+	}
+
+	/* Model point to world */
+	Vec3 apply(Vec3 p) const
+	{
+		Vec3 r(vec_dot(rot[0], p), vec_dot(rot[1], p), vec_dot(rot[2], p));
+		return vec_add(vec_mult(r, scale), translation);
+	}
+
+	/* A world direction in the model's axes (unscaled) */
+	Vec3 to_model_dir(Vec3 v) const
+	{
+		return vec_add(vec_add(vec_mult(rot[0], v.x), vec_mult(rot[1], v.y)),
+				vec_mult(rot[2], v.z));
+	}
+
+	/* World point to model */
+	Vec3 to_model(Vec3 p) const
+	{
+		return vec_mult(to_model_dir(vec_sub(p, translation)), 1.0 / scale);
+	}
+};
 
 /* For debugging purposes */
-void vec_print(std::vector<double> a);
+void vec_print(Vec2 a);
+void vec_print(Vec3 a);
 #endif
@@ -0,0 +1,304 @@
+#include <inttypes.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "reference.hh"
+#include "render.hh"
+#include "scenes.hh"
+
+/*
+ * Checks that the renderer draws what it always has. Every canned scene is
+ * rendered along its camera path by both Renderer and the reference engine
+ * (see reference.hh), frame by frame, and the frames' hashes (characters,
+ * colours and distances) compared; the first cell that differs is
+ * reported. Frames go through one Renderer in order, so redrawing only what
+ * changed gets checked along with everything else.
+ *
+ * -w writes the reference's hashes to a file instead, and -c checks Renderer
+ * against such a file without running the reference, which is quick enough
+ * for every build (see make check). When a frame doesn't match, the
+ * reference is run for it after all, to say where.
+ *
+ * Only double is expected to match exactly; float and fixed point can put
+ * cells on an edge on the other side and keep distances rounded (see
+ * raster.hh), so with those, only characters and colours are compared, and
+ * how many cells differ is the interesting part. The golden hashes take in
+ * distances, so those formats are always checked against the reference,
+ * even with -c.
+ *
+ * Usage: verify [-s scenes] [-g WxH,...] [-j workers,...] [-r formats]
+ *               [-n frames] [-i interval] [-w golden | -c golden] [-v]
+ * Exits with 1 if anything differed.
+ */
+
+/* What a golden file line starts with: "scene WxH frame" */
+static std::string frame_key(const Scene *s, int width, int height, int frame)
+{
+	char buf[96];
+	snprintf(buf, sizeof(buf), "%s %dx%d %d", s->name, width, height, frame);
+	return buf;
+}
+
+static int read_golden(const char *path, std::map<std::string, uint64_t> *out)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	char name[64], size[32];
+	int frame;
+	uint64_t hash;
+	int lineno = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%63s %31s %d %" SCNx64, name, size, &frame,
+					&hash) != 4) {
+			fprintf(stderr, "%s:%d: not a frame hash\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+		(*out)[std::string(name) + " " + size + " " + std::to_string(frame)] =
+			hash;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void describe(char *buf, size_t len, Render_symbol s, double d)
+{
+	snprintf(buf, len, "'%c' fg %d bg %d at %.17g", s.get_char(), s.get_fg(),
+			s.get_bg(), d);
+}
+
+/*
+ * Reports the first cell where a and b differ, and how many do. Distances
+ * only count if depth is set. Returns the number of cells.
+ */
+static size_t compare(const char *what, Screen_span a, Depth_span ad,
+		Screen_span b, Depth_span bd, int depth)
+{
+	size_t n = 0;
+	int fy = -1, fx = -1;
+	for (int y = 0; y < a.height; ++y) {
+		for (int x = 0; x < a.width; ++x) {
+			/* Compared as bits, like the hash, so NaNs can't hide */
+			int same = a[y][x] == b[y][x] && (!depth ||
+					!memcmp(&ad[y][x], &bd[y][x], sizeof(double)));
+			if (same)
+				continue;
+			if (!n++) {
+				fy = y;
+				fx = x;
+			}
+		}
+	}
+	if (n) {
+		char got[96], want[96];
+		describe(got, sizeof(got), a[fy][fx], ad[fy][fx]);
+		describe(want, sizeof(want), b[fy][fx], bd[fy][fx]);
+		printf("%s: %zu cells differ, first at row %d column %d: %s, "
+				"reference has %s\n", what, n, fy, fx, got, want);
+	}
+	return n;
+}
+
+struct Options {
+	int frames;
+	int interval;
+	int verbose;
+	/* Golden hashes to check against, or to write to */
+	std::map<std::string, uint64_t> golden;
+	FILE *write_golden;
+};
+
+/*
+ * Renders scene's frames at width x height in format with workers threads,
+ * and checks them. Returns how many frames differed.
+ */
+static int run(const Scene *scene, int width, int height, int workers,
+		Raster_format format, Options *o)
+{
+	Renderer r(height, width, 3.0, scene->max_objects, workers, format);
+	scene->build(&r);
+	Reference_renderer ref(height, width, 3.0);
+	int exact = format == raster_double;
+	/* The hashes are of distances too, which only double gets exactly */
+	int from_golden = exact && !o->golden.empty();
+	int bad = 0;
+	size_t bad_cells = 0;
+	for (int i = 0; i < o->frames; ++i) {
+		int f = i * o->interval;
+		scene_camera(scene, f, &r);
+		std::string key = frame_key(scene, width, height, f);
+
+		if (o->write_golden) {
+			ref.render(r);
+			fprintf(o->write_golden, "%s %016" PRIx64 "\n", key.c_str(),
+					frame_hash(ref.symbols(), ref.depth()));
+			continue;
+		}
+
+		Screen_span s = r.render();
+		Depth_span d = r.depth();
+		if (from_golden) {
+			std::map<std::string, uint64_t>::const_iterator g =
+				o->golden.find(key);
+			if (g == o->golden.end()) {
+				printf("%s: not in the golden hashes\n", key.c_str());
+				++bad;
+				continue;
+			}
+			if (frame_hash(s, d) == g->second)
+				continue;
+		}
+
+		/* Only needed when there is no golden hash, or it didn't match */
+		ref.render(r);
+		char what[160];
+		snprintf(what, sizeof(what), "%s %s -j %d", key.c_str(),
+				raster_format_name(format), workers);
+		size_t n = compare(what, s, d, ref.symbols(), ref.depth(), exact);
+		if (n) {
+			++bad;
+			bad_cells += n;
+		} else if (from_golden) {
+			printf("%s: matches the reference, but not the golden hash\n",
+					what);
+			++bad;
+		}
+	}
+
+	if (o->verbose || bad)
+		printf("%-12s %4dx%-4d %-6s -j %d: %d of %d frames differ "
+				"(%zu cells)\n", scene->name, width, height,
+				raster_format_name(format), workers, bad, o->frames, bad_cells);
+	return bad;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s scenes] [-g WxH,...] [-j workers,...] "
+			"[-r double|float|fixed,...] [-n frames] [-i interval] "
+			"[-w golden | -c golden] [-v]\nscenes:\n", prog);
+	print_scenes(stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const Scene *> which;
+	std::vector<std::pair<int, int> > sizes;
+	std::vector<int> workers;
+	std::vector<Raster_format> formats;
+	Options o;
+	/* 24 frames 13 apart go most of the way round the usual orbit */
+	o.frames = 24;
+	o.interval = 13;
+	o.verbose = 0;
+	o.write_golden = 0;
+	const char *write_path = 0;
+	const char *check_path = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:g:j:r:n:i:w:c:vh")) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_scenes(optarg, &which) < 0)
+				usage(argv[0]);
+			break;
+		case 'g':
+			if (parse_sizes(optarg, &sizes) < 0)
+				usage(argv[0]);
+			break;
+		case 'j':
+			if (parse_workers(optarg, &workers) < 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (parse_formats(optarg, &formats) < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			o.frames = atoi(optarg);
+			if (o.frames < 1)
+				usage(argv[0]);
+			break;
+		case 'i':
+			o.interval = atoi(optarg);
+			if (o.interval < 1)
+				usage(argv[0]);
+			break;
+		case 'w':
+			write_path = optarg;
+			break;
+		case 'c':
+			check_path = optarg;
+			break;
+		case 'v':
+			o.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc || (write_path && check_path))
+		usage(argv[0]);
+
+	/* Defaults: everything, at main's old size and a bigger one */
+	if (which.empty()) {
+		for (int i = 0; i < n_scenes; ++i)
+			which.push_back(&scenes[i]);
+	}
+	if (sizes.empty()) {
+		sizes.push_back(std::make_pair(56, 24));
+		sizes.push_back(std::make_pair(160, 60));
+	}
+	if (workers.empty()) {
+		workers.push_back(1);
+		workers.push_back(4);
+	}
+	if (formats.empty())
+		formats.push_back(raster_double);
+
+	if (check_path && read_golden(check_path, &o.golden) < 0)
+		return 1;
+	if (write_path) {
+		o.write_golden = fopen(write_path, "w");
+		if (!o.write_golden) {
+			perror(write_path);
+			return 1;
+		}
+		fprintf(o.write_golden, "# scene size frame hash, from the reference "
+				"engine; see verify.cc\n");
+		/* The reference doesn't care how it would have been drawn */
+		workers.resize(1);
+		formats.resize(1);
+	}
+
+	int bad = 0, runs = 0;
+	for (size_t s = 0; s < which.size(); ++s)
+		for (size_t g = 0; g < sizes.size(); ++g)
+			for (size_t j = 0; j < workers.size(); ++j)
+				for (size_t f = 0; f < formats.size(); ++f, ++runs)
+					bad += run(which[s], sizes[g].first, sizes[g].second,
+							workers[j], formats[f], &o) > 0;
+
+	if (o.write_golden) {
+		if (fclose(o.write_golden) != 0) {
+			perror(write_path);
+			return 1;
+		}
+		return 0;
+	}
+	printf("%d of %d runs differ\n", bad, runs);
+	return bad > 0;
+}
@@ -0,0 +1,72 @@
+#include "workers.hh"
+
+Worker_pool::Worker_pool(int n_threads)
+	: generation(0), busy(0), quit(0), job_fn(0), job_ctx(0), n_jobs(0),
+	next_job(0)
+{
+	for (int i = 0; i < n_threads; ++i)
+		threads.emplace_back(&Worker_pool::worker_main, this);
+}
+
+Worker_pool::~Worker_pool()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		quit = 1;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+void Worker_pool::run(void (*fn)(void *, int), void *ctx, int n)
+{
+	if (threads.empty()) {
+		for (int i = 0; i < n; ++i)
+			fn(ctx, i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(lock);
+		job_fn = fn;
+		job_ctx = ctx;
+		n_jobs = n;
+		next_job.store(0, std::memory_order_relaxed);
+		busy = (int) threads.size();
+		++generation;
+	}
+	wake.notify_all();
+
+	/* Help out rather than sit idle */
+	do_jobs();
+
+	std::unique_lock<std::mutex> l(lock);
+	done.wait(l, [this] { return busy == 0; });
+}
+
+void Worker_pool::do_jobs()
+{
+	int i;
+	while ((i = next_job.fetch_add(1, std::memory_order_relaxed)) < n_jobs)
+		job_fn(job_ctx, i);
+}
+
+void Worker_pool::worker_main()
+{
+	unsigned long seen = 0;
+	std::unique_lock<std::mutex> l(lock);
+	while (1) {
+		wake.wait(l, [&] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+		l.unlock();
+
+		do_jobs();
+
+		l.lock();
+		if (--busy == 0)
+			done.notify_one();
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef WORKERS_H_I
+#define WORKERS_H_I
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of threads that sit around waiting for batches of jobs.
+ * Starting threads per frame would cost more than the work they do, so
+ * they are started once and woken up for each batch.
+ */
+class Worker_pool {
+	public:
+		/* Starts n_threads threads in addition to the caller's own */
+		explicit Worker_pool(int n_threads);
+		~Worker_pool();
+		/*
+		 * Calls fn(ctx, i) for every i in [0, n_jobs), spread over the pool
+		 * and the calling thread, and returns once all of them are done.
+		 * Jobs are handed out in increasing order but may finish in any.
+		 */
+		void run(void (*fn)(void *ctx, int job), void *ctx, int n_jobs);
+		/* Number of threads that work on a batch, counting the caller */
+		int size() const { return (int) threads.size() + 1; }
+	private:
+		void worker_main();
+		void do_jobs();
+
+		std::vector<std::thread> threads;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+		/* Incremented for every batch so sleeping workers can tell */
+		unsigned long generation;
+		/* Pool threads that haven't finished the current batch yet */
+		int busy;
+		int quit;
+
+		void (*job_fn)(void *, int);
+		void *job_ctx;
+		int n_jobs;
+		std::atomic<int> next_job;
+};
+
+#endif
@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+#include "world.hh"
+
+static const char world_magic[] = "tetraspin world";
+static const int world_version = 1;
+
+static int fail(std::string *error, const std::string &what)
+{
+	if (error)
+		*error = what;
+	return -1;
+}
+
+/* Chunk coordinates go up to a million either way */
+static uint64_t grid_key(int x, int y, int z)
+{
+	const int64_t off = 1 << 20;
+	return ((uint64_t) (x + off) << 42) | ((uint64_t) (y + off) << 21) |
+		(uint64_t) (z + off);
+}
+
+static std::string chunk_path(const std::string &dir, int x, int y, int z)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%d_%d_%d.tsc", x, y, z);
+	return dir + name;
+}
+
+int is_world(const char *path)
+{
+	std::string index = std::string(path) + "/index";
+	FILE *f = fopen(index.c_str(), "r");
+	if (!f)
+		return 0;
+	char magic[sizeof(world_magic)];
+	int yes = fread(magic, sizeof(magic) - 1, 1, f) == 1 &&
+		!memcmp(magic, world_magic, sizeof(magic) - 1);
+	fclose(f);
+	return yes;
+}
+
+World_writer::World_writer(double chunk_size)
+	: chunk_size(chunk_size)
+{
+}
+
+int World_writer::open(const char *dir, std::string *error)
+{
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+		return fail(error, std::string(dir) + ": " + strerror(errno));
+	this->dir = dir;
+	this->entries.clear();
+	this->written.clear();
+	return 0;
+}
+
+int World_writer::add(Renderer *r, std::string *error)
+{
+	/* Sorted out by chunk first, as each chunk is one file */
+	std::unordered_map<uint64_t, std::vector<Render_object *> > chunks;
+	std::vector<uint64_t> order;
+	for (int i = 0; i < r->object_count(); ++i) {
+		Render_object *obj = &r->objects[i];
+		/* Nothing to draw, and a scene cache can't hold it */
+		if (!obj->n_triangles())
+			continue;
+		if (obj->bounds_dirty || !obj->bvh.built())
+			obj->update_bounds();
+		Vec3 c = obj->world_bounds().centre();
+		uint64_t key = grid_key((int) floor(c.x / this->chunk_size),
+				(int) floor(c.y / this->chunk_size),
+				(int) floor(c.z / this->chunk_size));
+		std::vector<Render_object *> &objs = chunks[key];
+		if (objs.empty())
+			order.push_back(key);
+		objs.push_back(obj);
+	}
+
+	for (size_t i = 0; i < order.size(); ++i) {
+		const std::vector<Render_object *> &objs = chunks[order[i]];
+		Vec3 c = objs[0]->world_bounds().centre();
+		Entry e;
+		e.x = (int) floor(c.x / this->chunk_size);
+		e.y = (int) floor(c.y / this->chunk_size);
+		e.z = (int) floor(c.z / this->chunk_size);
+		std::string path = chunk_path(this->dir, e.x, e.y, e.z);
+		if (this->written.count(order[i]))
+			return fail(error, path + ": chunk written twice");
+		if (write_scene_cache(path.c_str(), objs.data(), objs.size(),
+					error) < 0)
+			return -1;
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0)
+			return fail(error, path + ": " + strerror(errno));
+		e.bytes = st.st_size;
+		e.objects = objs.size();
+		e.triangles = 0;
+		for (size_t j = 0; j < objs.size(); ++j)
+			e.triangles += objs[j]->n_triangles();
+		this->written[order[i]] = this->entries.size();
+		this->entries.push_back(e);
+	}
+	return 0;
+}
+
+int World_writer::close(std::string *error)
+{
+	std::string path = this->dir + "/index";
+	std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (!f)
+		return fail(error, tmp + ": " + strerror(errno));
+	/* In grid order, which is easier on whoever reads it */
+	std::vector<Entry> e = this->entries;
+	std::sort(e.begin(), e.end(), [](const Entry &a, const Entry &b) {
+		if (a.z != b.z)
+			return a.z < b.z;
+		if (a.y != b.y)
+			return a.y < b.y;
+		return a.x < b.x;
+	});
+	fprintf(f, "%s %d %.17g\n", world_magic, world_version, this->chunk_size);
+	for (size_t i = 0; i < e.size(); ++i)
+		fprintf(f, "%d %d %d %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", e[i].x,
+				e[i].y, e[i].z, e[i].bytes, e[i].objects, e[i].triangles);
+	int ok = !ferror(f);
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+		int err = errno;
+		unlink(tmp.c_str());
+		return fail(error, path + ": " + strerror(err));
+	}
+	return 0;
+}
+
+static long now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000l + t.tv_nsec;
+}
+
+World_stream::World_stream(double radius, double lookahead)
+	: radius(radius), lookahead(lookahead), chunk_size(1.0), budget(0),
+	last_ns(0), quit(0)
+{
+	for (int i = 0; i < 3; ++i) {
+		this->lo[i] = 0;
+		this->hi[i] = -1;
+	}
+	this->counts.chunks = 0;
+	this->counts.loaded = 0;
+	this->counts.shown = 0;
+	this->counts.missing = 0;
+	this->counts.loaded_bytes = 0;
+	this->counts.reads = 0;
+	this->counts.evictions = 0;
+	this->counts.wasted = 0;
+	this->counts.failed = 0;
+	this->counts.read_ns = 0;
+	this->counts.max_read_ns = 0;
+}
+
+World_stream::~World_stream()
+{
+	{
+		std::lock_guard<std::mutex> l(this->lock);
+		this->quit = 1;
+	}
+	this->wake.notify_all();
+	if (this->loader.joinable())
+		this->loader.join();
+}
+
+int World_stream::open(const char *dir, size_t budget, std::string *error)
+{
+	std::string path = std::string(dir) + "/index";
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f)
+		return fail(error, path + ": " + strerror(errno));
+	char line[256];
+	int version = 0;
+	if (!fgets(line, sizeof(line), f) ||
+			strncmp(line, world_magic, sizeof(world_magic) - 1) ||
+			sscanf(line + sizeof(world_magic) - 1, "%d %lf", &version,
+				&this->chunk_size) != 2) {
+		fclose(f);
+		return fail(error, path + ": not a world's index");
+	}
+	if (version != world_version || !(this->chunk_size > 0.0)) {
+		fclose(f);
+		return fail(error, path + ": world of another version");
+	}
+
+	int lineno = 1;
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		Chunk c;
+		uint64_t bytes, objects, triangles;
+		if (sscanf(line, "%d %d %d %" SCNu64 " %" SCNu64 " %" SCNu64, &c.x,
+					&c.y, &c.z, &bytes, &objects, &triangles) != 6) {
+			fclose(f);
+			return fail(error, path + ":" + std::to_string(lineno) +
+					": not a chunk");
+		}
+		c.bytes = bytes;
+		c.wanted = 0;
+		c.requested = 0;
+		c.broken = 0;
+		c.shown = 0;
+		c.score = 0.0;
+		int at[3] = {c.x, c.y, c.z};
+		for (int i = 0; i < 3; ++i) {
+			if (this->chunks.empty() || at[i] < this->lo[i])
+				this->lo[i] = at[i];
+			if (this->chunks.empty() || at[i] > this->hi[i])
+				this->hi[i] = at[i];
+		}
+		this->chunk_at[grid_key(c.x, c.y, c.z)] = (int) this->chunks.size();
+		this->chunks.push_back(std::move(c));
+	}
+	fclose(f);
+
+	this->dir = dir;
+	this->budget = budget;
+	this->counts.chunks = (int) this->chunks.size();
+	this->loader = std::thread(&World_stream::loader_main, this);
+	return 0;
+}
+
+void World_stream::loader_main()
+{
+	std::unique_lock<std::mutex> l(this->lock);
+	while (1) {
+		this->wake.wait(l, [this] {
+			return this->quit || !this->requests.empty();
+		});
+		if (this->quit)
+			return;
+		Arrival a;
+		a.chunk = this->requests.back();
+		this->requests.pop_back();
+		/* Where chunks are never changes once open() is done */
+		const Chunk &c = this->chunks[a.chunk];
+		std::string path = chunk_path(this->dir, c.x, c.y, c.z);
+		l.unlock();
+
+		long t = now_ns();
+		a.data.reset(new Scene_cache());
+		if (a.data->read(path.c_str(), &a.error) < 0)
+			a.data.reset();
+		a.ns = now_ns() - t;
+
+		l.lock();
+		this->arrivals.push_back(std::move(a));
+	}
+}
+
+double World_stream::distance(const Chunk &c, Vec3 p) const
+{
+	double s = this->chunk_size;
+	double dx = std::max(std::max(c.x * s - p.x, p.x - (c.x + 1) * s), 0.0);
+	double dy = std::max(std::max(c.y * s - p.y, p.y - (c.y + 1) * s), 0.0);
+	double dz = std::max(std::max(c.z * s - p.z, p.z - (c.z + 1) * s), 0.0);
+	return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void World_stream::near(Vec3 p, double radius, std::vector<int> *out) const
+{
+	double at[3] = {p.x, p.y, p.z};
+	int from[3], to[3];
+	for (int i = 0; i < 3; ++i) {
+		/* Clamped in double first, as far away can be very far away */
+		double a = floor((at[i] - radius) / this->chunk_size);
+		double b = floor((at[i] + radius) / this->chunk_size);
+		from[i] = (int) std::max(a, (double) this->lo[i]);
+		to[i] = (int) std::min(b, (double) this->hi[i]);
+	}
+	for (int z = from[2]; z <= to[2]; ++z) {
+		for (int y = from[1]; y <= to[1]; ++y) {
+			for (int x = from[0]; x <= to[0]; ++x) {
+				std::unordered_map<uint64_t, int>::const_iterator i =
+					this->chunk_at.find(grid_key(x, y, z));
+				if (i != this->chunk_at.end() &&
+						this->distance(this->chunks[i->second], p) <= radius)
+					out->push_back(i->second);
+			}
+		}
+	}
+}
+
+void World_stream::show(Renderer *r, Chunk *c)
+{
+	c->data->add_to(r, &c->handles);
+	c->shown = 1;
+	++this->counts.shown;
+}
+
+void World_stream::hide(Renderer *r, Chunk *c)
+{
+	for (size_t i = 0; i < c->handles.size(); ++i)
+		r->remove_object(c->handles[i]);
+	c->handles.clear();
+	c->shown = 0;
+	--this->counts.shown;
+}
+
+void World_stream::update(Renderer *r, Vec3 camera, long now)
+{
+	/* Smoothed over half a second or so, so one odd frame doesn't count */
+	if (this->last_ns && now > this->last_ns) {
+		double dt = (now - this->last_ns) * 1e-9;
+		Vec3 v = vec_mult(vec_sub(camera, this->last_camera), 1.0 / dt);
+		double k = std::min(1.0, dt / 0.5);
+		this->velocity = vec_add(vec_mult(this->velocity, 1.0 - k),
+				vec_mult(v, k));
+	}
+	this->last_camera = camera;
+	this->last_ns = now;
+	/*
+	 * Where it's going: points along the next lookahead seconds of the
+	 * way, close enough together that what's in range of them covers it
+	 */
+	Vec3 way = vec_mult(this->velocity, this->lookahead);
+	double travel = sqrt(vec_dot(way, way));
+	int steps = (int) std::min(ceil(travel / (this->radius / 2)),
+			(double) max_steps);
+	Vec3 path[max_steps + 1];
+	path[0] = camera;
+	for (int k = 1; k <= steps; ++k)
+		path[k] = vec_add(camera, vec_mult(way, (double) k / steps));
+
+	/*
+	 * Whatever the loader hasn't started on goes back to not being asked
+	 * for, as the list is made again below; whatever it has stays asked
+	 * for, so that it doesn't get read twice
+	 */
+	std::vector<Arrival> in;
+	{
+		std::lock_guard<std::mutex> l(this->lock);
+		in.swap(this->arrivals);
+		for (size_t i = 0; i < this->requests.size(); ++i)
+			this->chunks[this->requests[i]].requested = 0;
+		this->requests.clear();
+	}
+	for (size_t i = 0; i < in.size(); ++i) {
+		Chunk &c = this->chunks[in[i].chunk];
+		c.requested = 0;
+		++this->counts.reads;
+		this->counts.read_ns += in[i].ns;
+		this->counts.max_read_ns = std::max(this->counts.max_read_ns,
+				in[i].ns);
+		if (!in[i].data) {
+			c.broken = 1;
+			++this->counts.failed;
+			this->counts.error = in[i].error;
+		} else if (!c.wanted) {
+			/* Its room was needed for something nearer while it was read */
+			++this->counts.wasted;
+		} else {
+			c.data = std::move(in[i].data);
+			++this->counts.loaded;
+			this->counts.loaded_bytes += c.data->bytes();
+		}
+	}
+
+	/*
+	 * What should be in memory: everything in range, near the camera
+	 * now or where it's going, and whatever is loaded already, nearest
+	 * first until the budget is used up. Last time's candidates include
+	 * everything that was loaded or being read then.
+	 */
+	for (size_t i = 0; i < this->candidates.size(); ++i)
+		this->chunks[this->candidates[i]].wanted = 0;
+	std::vector<int> &cand = this->candidates;
+	std::vector<int> loaded;
+	for (size_t i = 0; i < cand.size(); ++i)
+		if (this->chunks[cand[i]].data || this->chunks[cand[i]].requested)
+			loaded.push_back(cand[i]);
+	cand.swap(loaded);
+	/* A little beyond what's drawn, so that there's no edge to flicker at */
+	double margin = this->chunk_size / 2;
+	this->near(camera, this->radius + margin, &cand);
+	for (int k = 1; k <= steps; ++k)
+		this->near(path[k], this->radius, &cand);
+	std::sort(cand.begin(), cand.end());
+	cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+	for (size_t i = 0; i < cand.size(); ++i) {
+		/* How far the camera has to go before it's in range, roughly */
+		Chunk &c = this->chunks[cand[i]];
+		c.score = this->distance(c, camera);
+		for (int k = 1; k <= steps; ++k)
+			c.score = std::min(c.score, this->distance(c, path[k]) +
+					travel * k / steps);
+		/* A chunk in hand beats one as far away that has to be read */
+		if (c.data)
+			c.score -= margin;
+	}
+	std::sort(cand.begin(), cand.end(), [this](int a, int b) {
+		return this->chunks[a].score < this->chunks[b].score;
+	});
+	size_t total = 0;
+	for (size_t i = 0; i < cand.size(); ++i) {
+		Chunk &c = this->chunks[cand[i]];
+		if (c.broken || total + c.bytes > this->budget)
+			continue;
+		total += c.bytes;
+		c.wanted = 1;
+	}
+
+	/* Out of memory what doesn't fit, and out of the renderer what's far */
+	this->counts.missing = 0;
+	for (size_t i = 0; i < cand.size(); ++i) {
+		Chunk &c = this->chunks[cand[i]];
+		double d = this->distance(c, camera);
+		if (c.data && !c.wanted) {
+			if (c.shown)
+				this->hide(r, &c);
+			--this->counts.loaded;
+			this->counts.loaded_bytes -= c.data->bytes();
+			c.data.reset();
+			++this->counts.evictions;
+		} else if (c.shown && d > this->radius + margin) {
+			this->hide(r, &c);
+		} else if (c.data && !c.shown && d <= this->radius) {
+			this->show(r, &c);
+		} else if (!c.data && !c.broken && d <= this->radius) {
+			++this->counts.missing;
+		}
+	}
+
+	/* The loader gets a new list, best last */
+	std::lock_guard<std::mutex> l(this->lock);
+	for (size_t i = cand.size(); i-- > 0; ) {
+		Chunk &c = this->chunks[cand[i]];
+		if (!c.wanted || c.data || c.requested)
+			continue;
+		c.requested = 1;
+		this->requests.push_back(cand[i]);
+	}
+	if (!this->requests.empty())
+		this->wake.notify_one();
+}
+
+void World_stream::detach(Renderer *r)
+{
+	for (size_t i = 0; i < this->candidates.size(); ++i) {
+		Chunk &c = this->chunks[this->candidates[i]];
+		if (c.shown)
+			this->hide(r, &c);
+	}
+}
+
+Aabb World_stream::bounds() const
+{
+	Aabb b;
+	if (this->chunks.empty())
+		return b;
+	double s = this->chunk_size;
+	b.grow(Vec3(this->lo[0] * s, this->lo[1] * s, this->lo[2] * s));
+	b.grow(Vec3((this->hi[0] + 1) * s, (this->hi[1] + 1) * s,
+				(this->hi[2] + 1) * s));
+	return b;
+}
@@ -0,0 +1,201 @@
+#ifndef WORLD_H_I
+#define WORLD_H_I
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "render.hh"
+#include "scene_cache.hh"
+
+/*
+ * A world too big to keep in memory, cut into chunks on a uniform grid and
+ * kept on disk, so that only the part around the camera is ever loaded.
+ *
+ * On disk a world is a directory: a scene cache (see scene_cache.hh) for
+ * each chunk that has anything in it, called x_y_z.tsc after its place on
+ * the grid, and a text file called index that lists them:
+ *   tetraspin world 1 <chunk size>
+ *   <x> <y> <z> <bytes> <objects> <triangles>     (one line per chunk)
+ * Chunk (x, y, z) is the cube from (x, y, z) * size to (x + 1, y + 1, z + 1)
+ * * size; an object is in the chunk its middle is in, even if some of it
+ * sticks out.
+ */
+
+/* Whether path is a world's directory */
+int is_world(const char *path);
+
+/*
+ * Writes a world a piece at a time, so that it never has to be in memory
+ * all at once: add() each piece, then close().
+ */
+class World_writer {
+	public:
+		explicit World_writer(double chunk_size);
+		/* Makes dir if it isn't there. Returns 0, or -1 with a reason. */
+		int open(const char *dir, std::string *error = 0);
+		/*
+		 * Writes r's objects to the chunks they are in. Each chunk has to
+		 * come in one piece: a chunk that an earlier add() wrote is an
+		 * error. As for write_scene_cache().
+		 */
+		int add(Renderer *r, std::string *error = 0);
+		/* Writes the index. Returns 0, or -1 with a reason. */
+		int close(std::string *error = 0);
+
+	private:
+		struct Entry {
+			int x, y, z;
+			uint64_t bytes, objects, triangles;
+		};
+
+		double chunk_size;
+		std::string dir;
+		std::vector<Entry> entries;
+		std::unordered_map<uint64_t, size_t> written;
+};
+
+/*
+ * Shows a world on disk a chunk at a time. A thread of its own reads the
+ * chunks around the camera into memory, nearest first, and also the ones
+ * around where the camera is heading, going by how it has been moving; the
+ * render thread adds them to the renderer once they are in, and takes them
+ * out again once they are out of range. Nothing on the render thread waits
+ * for the disk: a chunk that hasn't arrived yet just isn't drawn.
+ *
+ * Chunks stay in memory after going out of range, in case the camera comes
+ * back, until the room is needed: what's loaded (or being loaded) is kept
+ * within budget bytes by throwing out the chunks farthest from the camera
+ * first. The one chunk being read when its place is taken can take it
+ * over budget until it arrives and is thrown away.
+ */
+class World_stream {
+	public:
+		/*
+		 * Chunks within radius of the camera are drawn; ones within
+		 * radius of where it will be in the next lookahead seconds are
+		 * loaded ahead of time
+		 */
+		World_stream(double radius = 200.0, double lookahead = 2.0);
+		/*
+		 * Stops the loader. Any renderer the world's chunks were added to
+		 * mustn't draw again, unless they were taken out with detach().
+		 */
+		~World_stream();
+		/*
+		 * Reads dir's index and starts loading, within budget bytes.
+		 * Returns 0, or -1 with a reason.
+		 */
+		int open(const char *dir, size_t budget, std::string *error = 0);
+		/*
+		 * Once a frame, before r->render(): adds the chunks that have
+		 * arrived, takes out the ones that have gone out of range, and
+		 * tells the loader what to read next. camera is where the frame
+		 * is drawn from, and now_ns the time (CLOCK_MONOTONIC).
+		 */
+		void update(Renderer *r, Vec3 camera, long now_ns);
+		/* Takes every chunk out of r */
+		void detach(Renderer *r);
+		/* Where the world's chunks are, all told */
+		Aabb bounds() const;
+
+		struct Stats {
+			/* Chunks in the world, in memory, and in the renderer */
+			int chunks, loaded, shown;
+			/* In range, but not in memory yet */
+			int missing;
+			/* Memory the loaded chunks take */
+			size_t loaded_bytes;
+			/* Chunks read, thrown out, and read for nothing */
+			unsigned long reads, evictions, wasted;
+			/* Reads that failed (see error) */
+			unsigned long failed;
+			/* Time spent reading, all told and at most */
+			long read_ns, max_read_ns;
+			/* The last read that went wrong */
+			std::string error;
+		};
+		const Stats &stats() const { return counts; }
+
+	private:
+		World_stream(const World_stream &);
+		World_stream &operator=(const World_stream &);
+
+		struct Chunk {
+			int x, y, z;
+			size_t bytes;
+			/* Whether it's among what should be in memory, as of update() */
+			int wanted;
+			/* Asked for, and not arrived yet */
+			int requested;
+			/* Couldn't be read, so isn't asked for again */
+			int broken;
+			/* Its objects, once it's in memory */
+			std::unique_ptr<Scene_cache> data;
+			/* In the renderer, if shown */
+			int shown;
+			std::vector<Object_handle> handles;
+			/* For sorting: how far away it is */
+			double score;
+		};
+
+		/* What the loader has finished with */
+		struct Arrival {
+			int chunk;
+			std::unique_ptr<Scene_cache> data;
+			std::string error;
+			long ns;
+		};
+
+		/* Points along the camera's way that chunks are loaded around */
+		static const int max_steps = 16;
+
+		void loader_main();
+		/* Distance from p to chunk c's cube */
+		double distance(const Chunk &c, Vec3 p) const;
+		/* Chunks whose cubes come within radius of p, added to *out */
+		void near(Vec3 p, double radius, std::vector<int> *out) const;
+		void show(Renderer *r, Chunk *c);
+		void hide(Renderer *r, Chunk *c);
+
+		double radius, lookahead;
+		double chunk_size;
+		std::string dir;
+		size_t budget;
+		std::vector<Chunk> chunks;
+		/* Chunk's index by its place on the grid */
+		std::unordered_map<uint64_t, int> chunk_at;
+		/* Grid range the world covers */
+		int lo[3], hi[3];
+
+		/* Where the camera was last time, and how fast it's going */
+		Vec3 last_camera;
+		long last_ns;
+		Vec3 velocity;
+		/*
+		 * What the last update() went through: everything that was in
+		 * memory, being read, or in range
+		 */
+		std::vector<int> candidates;
+
+		/*
+		 * Shared with the loader: what to read, best last, and what it
+		 * has read. The loader only holds lock to take a request or hand
+		 * something back, never while it reads.
+		 */
+		std::mutex lock;
+		std::condition_variable wake;
+		std::vector<int> requests;
+		std::vector<Arrival> arrivals;
+		int quit;
+		std::thread loader;
+
+		Stats counts;
+};
+
+#endif
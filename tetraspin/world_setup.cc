@@ -1,5 +1,10 @@
 #include <math.h>
+#include <algorithm>
 #include <iostream>
+#include <utility>
+#include "mesh_import.hh"
+#include "scene_cache.hh"
+#include "world.hh"
 #include "world_setup.hh"
 #include "vec_ops.hh"
 
@@ -11,26 +16,185 @@ void setup(Renderer *renderer)
 	
 	//double length = 15.0;
 	double length = 20.0;
-	std::vector<double> base({0.0, 60.0, -8.0});
-	std::vector<double> vertices[4] = {{0.0, -1.0, 0.0},
-									   {-cos(M_PI/6), sin(M_PI/6), 0.0},
-									   {cos(M_PI/6), sin(M_PI/6), 0.0},
-									   {0.0, 0.0, sqrt(2.0/3.0)}};
+	Vec3 base(0.0, 60.0, -8.0);
+	Vec3 vertices[4] = {Vec3(0.0, -1.0, 0.0),
+						Vec3(-cos(M_PI/6), sin(M_PI/6), 0.0),
+						Vec3(cos(M_PI/6), sin(M_PI/6), 0.0),
+						Vec3(0.0, 0.0, sqrt(2.0/3.0))};
+	unsigned idx[4];
 	for (int i = 0; i < 4; ++i) {
 		vertices[i] = vec_add(vec_mult(vertices[i], length), base);
+		idx[i] = obj.add_vertex(vertices[i]);
 	}
+	/* Anticlockwise seen from outside, so the far side can be culled */
+	int faces[4][3] = {{0, 1, 2}, {0, 3, 1}, {0, 2, 3}, {1, 3, 2}};
 	for (int i = 0; i < 4; ++i) {
-		for (int j = i + 1; j < 4; ++j) {
-			for (int k = j + 1; k < 4; ++k) {
-				std::vector<double> p[3] = {vertices[i], vertices[j],
-					vertices[k]};
-				obj.add_triangle(p, '-', fg_red, bg_none, '*', fg_none, bg_white);
-			}
-		}
+		obj.add_triangle(idx[faces[i][0]], idx[faces[i][1]], idx[faces[i][2]],
+				'-', fg_red, bg_none, '*', fg_none, bg_white);
 	}
+	obj.cull_backfaces = 1;
 
 
-	renderer->add_object(obj);
+	renderer->add_object(std::move(obj));
 	return;
 
 }
+
+int setup_mesh(Renderer *renderer, const char *path)
+{
+	/*
+	 * A scene cache is already laid out the way it's drawn, so it just gets
+	 * mapped. The mapping has to stay around as long as the renderer does.
+	 */
+	if (is_scene_cache(path)) {
+		static Scene_cache cache;
+		std::string error;
+		if (cache.open(path, &error) < 0) {
+			std::cerr << error << std::endl;
+			return -1;
+		}
+		cache.add_to(renderer);
+		return 0;
+	}
+
+	Render_object *obj = renderer->object(renderer->add_object(Render_object()));
+	Triangle_style style = {Render_symbol('.', fg_red), Render_symbol('*',
+			fg_none, bg_white)};
+	std::string error;
+	/* Straight into the renderer's own object, so nothing gets copied */
+	if (import_mesh(path, obj, style, 0, &error) < 0) {
+		std::cerr << error << std::endl;
+		return -1;
+	}
+
+	/* Fit it in a box the size of the tetrahedron, centred where it is */
+	Aabb box;
+	for (size_t i = 0; i < obj->vertices.size(); ++i)
+		box.grow(obj->vertices[i]);
+	if (box.empty())
+		return 0;
+	Vec3 e = box.extent();
+	double biggest = std::max(e.x, std::max(e.y, e.z));
+	double scale = biggest > 0.0 ? 10.0 / biggest : 1.0;
+	Vec3 from = box.centre();
+	Vec3 to(0.0, 60.0, 0.0);
+	Vertex_buffer &vb = obj->vertices;
+	for (size_t i = 0; i < vb.size(); ++i) {
+		vb.xs[i] = (vb.xs[i] - from.x) * scale + to.x;
+		vb.ys[i] = (vb.ys[i] - from.y) * scale + to.y;
+		vb.zs[i] = (vb.zs[i] - from.z) * scale + to.z;
+	}
+	obj->bounds_dirty = 1;
+	return 0;
+}
+
+/* Same numbers in, same number out, between 0 and 1 */
+static double noise(int x, int y, int i)
+{
+	uint64_t h = (uint64_t) (uint32_t) x * 0x9e3779b97f4a7c15ull ^
+		(uint64_t) (uint32_t) y * 0xc2b2ae3d27d4eb4full ^
+		(uint64_t) (uint32_t) i * 0x165667b19e3779f9ull;
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 29;
+	return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Box from lo to hi with a band of wall for each floor, wound so that its
+ * back can be culled. It has no floor, as it stands on the ground.
+ */
+static void add_tower(Render_object *obj, Vec3 lo, Vec3 hi, int floors,
+		enum bg_colour bg)
+{
+	double xs[4] = {lo.x, hi.x, hi.x, lo.x};
+	double ys[4] = {lo.y, lo.y, hi.y, hi.y};
+	unsigned idx[4];
+	unsigned below[4];
+	for (int k = 0; k <= floors; ++k) {
+		double z = lo.z + (hi.z - lo.z) * k / floors;
+		for (int i = 0; i < 4; ++i)
+			idx[i] = obj->add_vertex(Vec3(xs[i], ys[i], z));
+		/* Anticlockwise from above, so outwards is to the right */
+		for (int i = 0; k && i < 4; ++i) {
+			int j = (i + 1) & 3;
+			char window = (k & 1) ? '#' : '=';
+			obj->add_triangle(below[i], below[j], idx[j], ' ', fg_black, bg,
+					window, fg_black, bg);
+			obj->add_triangle(below[i], idx[j], idx[i], ' ', fg_black, bg,
+					window, fg_black, bg);
+		}
+		for (int i = 0; i < 4; ++i)
+			below[i] = idx[i];
+	}
+	obj->add_triangle(idx[0], idx[1], idx[2], '+', fg_white, bg_none, ' ',
+			fg_none, bg_none);
+	obj->add_triangle(idx[0], idx[2], idx[3], '+', fg_white, bg_none, ' ',
+			fg_none, bg_none);
+	obj->cull_backfaces = 1;
+}
+
+/* Chunk (cx, cy): a square of ground, and towers on some of its lots */
+static void add_block(Renderer *r, int cx, int cy)
+{
+	double s = world_chunk_size;
+	Vec3 corner(cx * s, cy * s, 0.0);
+
+	/* Its edges show where chunks start and end */
+	Render_object ground;
+	unsigned g[4];
+	for (int i = 0; i < 4; ++i)
+		g[i] = ground.add_vertex(vec_add(corner, Vec3((i == 1 || i == 2) ? s :
+						0.0, i >= 2 ? s : 0.0, 0.0)));
+	ground.add_triangle(g[0], g[1], g[2], '.', fg_green, bg_none, ' ',
+			fg_none, bg_none);
+	ground.add_triangle(g[0], g[2], g[3], '.', fg_green, bg_none, ' ',
+			fg_none, bg_none);
+	r->add_object(std::move(ground));
+
+	static const enum bg_colour colours[] = {bg_red, bg_yellow, bg_blue,
+		bg_magenta, bg_cyan, bg_white};
+	const int lots = 4;
+	double lot = s / lots;
+	for (int ly = 0; ly < lots; ++ly) {
+		for (int lx = 0; lx < lots; ++lx) {
+			int i = ly * lots + lx;
+			if (noise(cx, cy, 4 * i) < 0.3)
+				continue;
+			double w = lot * (0.4 + 0.4 * noise(cx, cy, 4 * i + 1));
+			double h = 6.0 + 30.0 * noise(cx, cy, 4 * i + 2);
+			Vec3 mid = vec_add(corner, Vec3((lx + 0.5) * lot, (ly + 0.5) * lot,
+						0.0));
+			Render_object tower;
+			add_tower(&tower, vec_sub(mid, Vec3(w / 2, w / 2, 0.0)),
+					vec_add(mid, Vec3(w / 2, w / 2, h)), (int) (h / 3.0),
+					colours[(int) (noise(cx, cy, 4 * i + 3) * 6)]);
+			r->add_object(std::move(tower));
+		}
+	}
+}
+
+int setup_world(const char *dir, int side)
+{
+	World_writer w(world_chunk_size);
+	std::string error;
+	if (w.open(dir, &error) < 0) {
+		std::cerr << error << std::endl;
+		return -1;
+	}
+	for (int cy = 0; cy < side; ++cy) {
+		/* Only ever a row in memory */
+		Renderer row(2, 2, 3.0, side * 17);
+		for (int cx = 0; cx < side; ++cx)
+			add_block(&row, cx, cy);
+		if (w.add(&row, &error) < 0) {
+			std::cerr << error << std::endl;
+			return -1;
+		}
+	}
+	if (w.close(&error) < 0) {
+		std::cerr << error << std::endl;
+		return -1;
+	}
+	return 0;
+}
@@ -5,5 +5,20 @@
 
 /* Function to create something to look at */
 void setup(Renderer *renderer);
+/*
+ * Or look at a mesh from a file instead, scaled and moved to where the
+ * tetrahedron would be, or at a scene cache as it was saved. Returns 0, or
+ * -1 after saying what went wrong.
+ */
+int setup_mesh(Renderer *renderer, const char *path);
+/*
+ * Writes a made-up town to dir as a world (see world.hh), side x side chunks
+ * of towers on squares of ground, a row of chunks at a time so that it never
+ * has to fit in memory. Returns 0, or -1 after saying what went wrong.
+ */
+int setup_world(const char *dir, int side);
+/* Its chunks' size, and how high to look at it from */
+const double world_chunk_size = 40.0;
+const double world_eye_height = 12.0;
 
 #endif